@@ -1,3 +1,4 @@
+#include <iostream>
 #include "gl.h"
 #include "camera.h"
 #include "buffer.h"
@@ -18,31 +19,46 @@ vec3 up(0, 1, 0);
 class Shader : public IShader {
 public:
 	Texture *diff_map = nullptr;
-	mat4 uniform_model;
-	mat4 uniform_view;
-	mat4 uniform_projection;
+	mat4f uniform_model;
+	mat4f uniform_view;
+	mat4f uniform_projection;
 	mat4 uniform_MIT;
 
 	virtual vec4 vertex(int iface, int nthvert) {
-		varying_uv.set_col(nthvert, model->uv(iface, nthvert));
-		vec4 gl_Vertex = vec4(model->vert(iface, nthvert), 1.0);
+		varying_uv.set_col(nthvert, model->uv<float>(iface, nthvert));
+		vec4f gl_Vertex = vec4f(model->vert<float>(iface, nthvert), 1.f);
 		gl_Vertex = uniform_model * gl_Vertex;
-		gl_Vertex = uniform_projection * uniform_view * gl_Vertex;
-		return gl_Vertex;
+		return vec4(uniform_projection * (uniform_view * gl_Vertex));
 	}
 
 	virtual std::optional<color_t> fragment(vec3 bar) {
-		vec2 frag_uv = varying_uv * bar;
+		vec2 frag_uv = interpolate(varying_uv, bar);
 
 		color_t color;
-		color = diff_map->sample(frag_uv);
+		color = diff_map->sample(frag_uv, interpolate(varying_uv, bar_ddx), interpolate(varying_uv, bar_ddy));
 		// color = model->diffuse(frag_uv);
 		// color = color_t(123, 231, 12);
 
 		return std::optional<color_t>(color);
 	}
+
+	virtual int nvaryings() const {
+		return count_varyings(varying_uv);
+	}
+
+	virtual void save_varyings(int nthvert, double* out) const {
+		pack_varyings(out, nthvert, varying_uv);
+	}
+
+	virtual void load_varyings(int nthvert, const double* in) {
+		unpack_varyings(in, nthvert, varying_uv);
+	}
+
+	virtual std::unique_ptr<IShader> clone() const {
+		return std::make_unique<Shader>(*this);
+	}
 private:
-	mat<2, 3> varying_uv;
+	mat<2, 3, float> varying_uv;
 };
 
 int main(int argc, char **argv) {
@@ -63,9 +79,9 @@ int main(int argc, char **argv) {
 
 	Shader shader;
 	mat4 model_mat = mat4::identity();
-	shader.uniform_model = model_mat;
-	shader.uniform_view = camera.get_view_mat();
-	shader.uniform_projection = perspective(radius(45), (float)width / (float)height, -0.1, -100.0); 
+	shader.uniform_model = mat4f(model_mat);
+	shader.uniform_view = mat4f(camera.get_view_mat());
+	shader.uniform_projection = mat4f(perspective(radius(45), (float)width / (float)height, -0.1, -100.0)); 
 	shader.uniform_MIT = model_mat.invert_transpose();
 	shader.diff_map = &floor_diff;
 
@@ -74,13 +90,11 @@ int main(int argc, char **argv) {
 	ColorBuffer color_buf(width, height, color_t(0, 0, 0), 16);
 	DepthBuffer depth_buf(width, height, -std::numeric_limits<float>::max(), 16);
 	// draw model
-	model->draw(shader, vp, depth_buf, &color_buf, Triangle::MSAA16);
-	for (int x = 0; x < width; ++x) {
-		for (int y = 0; y < height; ++y) {
-			color_t c = color_buf.get_value(x, y);
-			image.set(x, y, c);
-		}
-	}
+	model->draw<Shader, Triangle::MSAA16>(shader, vp, depth_buf, &color_buf);
+	const DrawStats& ds = model->stats();
+	std::cout << "vertex transforms: " << ds.transforms << ", cache hits: " << ds.hits
+			  << ", culled: " << ds.culled << ", outside: " << ds.outside << std::endl;
+	resolve(color_buf, image, RESOLVE_TENT);
 
 	image.write_tga_file("msaa.tga");
 	delete model;
@@ -5,6 +5,7 @@
 #include "triangle.h"
 #include "model.h"
 #include "texture.h"
+#include "shadow_map.h"
 
 const int width  = 800;
 const int height = 800;
@@ -17,13 +18,13 @@ const vec3 up(0, 1, 0);
 class LightShader : public IShader {
 public:
 	Model *model;
-	mat4 uniform_model;
-	mat4 uniform_view;
-	mat4 uniform_proj;
+	mat4f uniform_model;
+	mat4f uniform_view;
+	mat4f uniform_proj;
 
 	virtual vec4 vertex(int iface, int nthvert) {
-		vec4 gl_Vertex = vec4(model->vert(iface, nthvert), 1.0);
-		return uniform_proj * uniform_view * uniform_model * gl_Vertex;
+		vec4f gl_Vertex = vec4f(model->vert<float>(iface, nthvert), 1.f);
+		return vec4(uniform_proj * (uniform_view * (uniform_model * gl_Vertex)));
 	}
 
 	virtual std::optional<color_t> fragment(vec3 bar) {
@@ -31,6 +32,12 @@ public:
 		color = color_t(1, 1, 1);
 		return std::optional<color_t>(color);
 	}
+
+	virtual int nvaryings() const { return 0; }
+
+	virtual std::unique_ptr<IShader> clone() const {
+		return std::make_unique<LightShader>(*this);
+	}
 private:
 };
 
@@ -38,18 +45,24 @@ private:
 class DepthShader : public IShader {
 public:
 	Model *model = nullptr;
-	mat4 uniform_model;
-	mat4 uniform_view;
-	mat4 uniform_projection;
+	mat4f uniform_model;
+	mat4f uniform_view;
+	mat4f uniform_projection;
 
 	virtual vec4 vertex(int iface, int nthvert) {
-		vec4 gl_Vertex = vec4(model->vert(iface, nthvert), 1.0);
-		return uniform_projection * uniform_view * uniform_model * gl_Vertex;
+		vec4f gl_Vertex = vec4f(model->vert<float>(iface, nthvert), 1.f);
+		return vec4(uniform_projection * (uniform_view * (uniform_model * gl_Vertex)));
 	}
 
 	virtual std::optional<color_t> fragment(vec3 bar) {
 		return std::optional<color_t>(color_t());
 	}
+
+	virtual int nvaryings() const { return 0; }
+
+	virtual std::unique_ptr<IShader> clone() const {
+		return std::make_unique<DepthShader>(*this);
+	}
 private:
 
 };
@@ -59,27 +72,29 @@ class Shader : public IShader {
 public:
 	Model   *model      = nullptr;
 	Texture *diff_map   = nullptr;
-	Texture *shadow_map = nullptr;
+	ShadowMap *shadow_map = nullptr;
 	Texture *normal_map = nullptr;
 	Texture *spec_map   = nullptr;
-	mat4 uniform_model;
-	mat4 uniform_view;
-	mat4 uniform_projection;
+	mat4f uniform_model;
+	mat4f uniform_view;
+	mat4f uniform_projection;
 	mat4 uniform_vp;
 	mat4 uniform_shadow;
 
 	virtual vec4 vertex(int iface, int nthvert) {
-		varying_uv.set_col(nthvert, model->uv(iface, nthvert));
-		varying_normal.set_col(nthvert, model->normal(iface, nthvert));
-		vec4 gl_Vertex = vec4(model->vert(iface, nthvert), 1.0);
+		varying_uv.set_col(nthvert, model->uv<float>(iface, nthvert));
+		varying_normal.set_col(nthvert, model->normal<float>(iface, nthvert));
+		varying_tangent.set_col(nthvert, model->tangent<float>(iface, nthvert));
+		varying_bitangent.set_col(nthvert, model->bitangent<float>(iface, nthvert));
+		vec4f gl_Vertex = vec4f(model->vert<float>(iface, nthvert), 1.f);
 		gl_Vertex = uniform_model * gl_Vertex;
-		varying_pos.set_col(nthvert, vec3(gl_Vertex));
-		return uniform_projection * uniform_view * gl_Vertex;
+		varying_pos.set_col(nthvert, vec3f(gl_Vertex));
+		return vec4(uniform_projection * (uniform_view * gl_Vertex));
 	}
 
 	virtual std::optional<color_t> fragment(vec3 bar) {
-		vec2 frag_uv = varying_uv * bar;
-		vec3 pos = vec3(varying_pos * bar);	// fragment position in world space
+		vec2 frag_uv = interpolate(varying_uv, bar);
+		vec3 pos = interpolate(varying_pos, bar);	// fragment position in world space
 
 		float shadow = 0.3 + 0.7 *  visibility(bar);
 
@@ -91,12 +106,12 @@ public:
 
 		float spec = 0;
 		if (spec_map) {
-			float f = spec_map->sample(frag_uv)[0] * 255;
+			float f = spec_map->sample(frag_uv, interpolate(varying_uv, bar_ddx), interpolate(varying_uv, bar_ddy))[0] * 255;
 			spec = pow(std::max(0.0, dot(r, n)), f);
 		}
 		float diff = std::max(0.0, dot(n, l));
 
-		color_t c = diff_map->sample(frag_uv);
+		color_t c = diff_map->sample(frag_uv, interpolate(varying_uv, bar_ddx), interpolate(varying_uv, bar_ddy));
 		color_t color;
 		for (int i = 0; i < 3; ++i) {
 			color[i] = std::min<float>(0.07 + c[i] * shadow * (1.2 * diff + 0.6 * spec), 1.0);
@@ -107,29 +122,39 @@ public:
 	}
 
 
+
+	virtual int nvaryings() const {
+		return count_varyings(varying_uv, varying_pos, varying_normal, varying_tangent, varying_bitangent);
+	}
+
+	virtual void save_varyings(int nthvert, double* out) const {
+		pack_varyings(out, nthvert, varying_uv, varying_pos, varying_normal, varying_tangent, varying_bitangent);
+	}
+
+	virtual void load_varyings(int nthvert, const double* in) {
+		unpack_varyings(in, nthvert, varying_uv, varying_pos, varying_normal, varying_tangent, varying_bitangent);
+	}
+
+	virtual std::unique_ptr<IShader> clone() const {
+		return std::make_unique<Shader>(*this);
+	}
 private:
-	mat<2, 3> varying_uv;
-	mat<3, 3> varying_pos;
-	mat<3, 3> varying_normal;
+	mat<2, 3, float> varying_uv;
+	mat<3, 3, float> varying_pos;
+	mat<3, 3, float> varying_normal;
+	mat<3, 3, float> varying_tangent;
+	mat<3, 3, float> varying_bitangent;
 
 	// tangent space to world space
 	vec3 tbn_normal(vec3 bar) {
-		vec2 frag_uv = varying_uv * bar;
-		vec3 bn = (varying_normal * bar).normalize();
-		mat3 A;
-		A[0] = varying_pos.col(1) - varying_pos.col(0);
-		A[1] = varying_pos.col(2) - varying_pos.col(0);
-		A[2] = bn;
-		A = A.invert();
-
-		vec3 i = A * vec3(varying_uv[0][1] - varying_uv[0][0], varying_uv[0][2] - varying_uv[0][0], 0);
-		vec3 j = A * vec3(varying_uv[1][1] - varying_uv[1][0], varying_uv[1][2] - varying_uv[1][0], 0);
+		vec2 frag_uv = interpolate(varying_uv, bar);
+		vec3 bn = interpolate(varying_normal, bar).normalize();
 		mat3 B;
-		B.set_col(0, i.normalize());
-		B.set_col(1, j.normalize());
+		B.set_col(0, interpolate(varying_tangent, bar).normalize());
+		B.set_col(1, interpolate(varying_bitangent, bar).normalize());
 		B.set_col(2, bn);
 
-		color_t tmp = normal_map->sample(frag_uv);
+		color_t tmp = normal_map->sample(frag_uv, interpolate(varying_uv, bar_ddx), interpolate(varying_uv, bar_ddy));
 		vec3 n = vec3(tmp.r, tmp.g, tmp.b) * 2.0 - vec3(1, 1, 1);
 		n = (B * n).normalize();
 		return n;
@@ -137,24 +162,14 @@ private:
 
 	float visibility(vec3& bar) {
 
-		vec3 p = varying_pos * bar;
+		vec3 p = interpolate(varying_pos, bar);
 		vec4 p1 = uniform_shadow * vec4(p, 1.0);
 		p1 = p1 / p1.w;
 		float cur_depth = p1.z;
 		p1 = 0.5 * p1 + 0.5;
 
-		float visib = 0;
 		float bias = 0.05;
-		vec2 texel_size = vec2(1.0/shadow_map->width(), 1.0/shadow_map->height());
-		for (int x = -3; x <= 3; ++x) {
-			for (int y = -3; y <= 3; ++y) {
-				float pcf_depth = shadow_map->sample(vec2(p1.x, p1.y) + vec2(x, y) * texel_size)[0];
-				pcf_depth = pcf_depth * 2 - 1;
-				float tmp = cur_depth + bias;
-				visib += tmp < pcf_depth ? 0.0 : 1.0;
-			}
-		}
-		return visib / 49.0;
+		return shadow_map->visibility(vec2(p1.x, p1.y), cur_depth + bias);
 	}
 };
 
@@ -162,6 +177,7 @@ private:
 int main(int argc, char **argv) {
 	Model *sphere = new Model("../obj/sphere/sphere.obj");
 	Model *head = new Model("../obj/african_head/african_head.obj");
+	head->cull_face(CULL_BACK);	// closed mesh, its back faces are always hidden
 	Model *floor  = new Model("../obj/floor/floor.obj");
 
 	mat3 m;
@@ -201,21 +217,21 @@ int main(int argc, char **argv) {
 	mat4 shadow_proj = perspective(radius(120), (float)width/(float)height, -1.1f, -100.0f);
 	{
 		DepthShader d_shader;
-		d_shader.uniform_projection = shadow_proj;
-		d_shader.uniform_view = shadow_view;
+		d_shader.uniform_projection = mat4f(shadow_proj);
+		d_shader.uniform_view = mat4f(shadow_view);
 
-		d_shader.uniform_model = head_model;
+		d_shader.uniform_model = mat4f(head_model);
 		d_shader.model = head;
-		head->draw(d_shader, vp, shadow_buf, nullptr, Triangle::MSAA4);
+		head->draw<DepthShader, Triangle::MSAA4>(d_shader, vp, shadow_buf, nullptr);
 
-		d_shader.uniform_model = floor_model;
+		d_shader.uniform_model = mat4f(floor_model);
 		d_shader.model = floor;
-		floor->draw(d_shader, vp, shadow_buf, nullptr, Triangle::MSAA4);
+		floor->draw<DepthShader, Triangle::MSAA4>(d_shader, vp, shadow_buf, nullptr);
 
 		for (int x = 0; x < width; ++x) {
 			for (int y = 0; y < height; ++y) {
 				// uint8_t depth = 127.5 * shadow_buf.get_value(x, y) + 127.5;
-				depth_t depth = shadow_buf.get_value(x, y);
+				depth_t depth = shadow_buf.get_nearest(x, y);
 				depth = depth / 2 + 0.5;
 				color_t c(depth);
 				shadow_map.set(x, y, c);
@@ -228,41 +244,37 @@ int main(int argc, char **argv) {
 	{
 		// draw light source
 		LightShader l_shader;
-		l_shader.uniform_view = view;
-		l_shader.uniform_proj = proj;
-		l_shader.uniform_model = sphere_model;
+		l_shader.uniform_view = mat4f(view);
+		l_shader.uniform_proj = mat4f(proj);
+		l_shader.uniform_model = mat4f(sphere_model);
 		l_shader.model = sphere;
-		sphere->draw(l_shader, vp, zbuf, &color_buf, Triangle::MSAA4);
+		sphere->draw<LightShader, Triangle::MSAA4>(l_shader, vp, zbuf, &color_buf);
 
 		Shader shader;
-		shader.uniform_projection = proj;
-		shader.uniform_view = view;
+		shader.uniform_projection = mat4f(proj);
+		shader.uniform_view = mat4f(view);
 		shader.uniform_shadow = shadow_proj * shadow_view;
-		Texture s_map(std::move(shadow_map));
+		ShadowMap s_map(shadow_buf);
 		shader.shadow_map = &s_map;
 		// shader.uniform_shadow_map = &shadow_map;
 
 		// draw head
-		shader.uniform_model = head_model;
+		shader.uniform_model = mat4f(head_model);
 		shader.diff_map = &head_diff;
 		shader.normal_map = &head_norm;
 		shader.spec_map = &head_spec;
 		shader.model = head;
-		head->draw(shader, vp, zbuf, &color_buf, Triangle::MSAA4);
+		head->draw<Shader, Triangle::MSAA4>(shader, vp, zbuf, &color_buf);
 
 		// draw floor
-		shader.uniform_model = floor_model;
+		shader.uniform_model = mat4f(floor_model);
 		shader.diff_map = &floor_diff;
 		shader.spec_map = nullptr;
 		shader.normal_map = &floor_norm;
 		shader.model = floor;
-		floor->draw(shader, vp, zbuf, &color_buf, Triangle::MSAA4);
+		floor->draw<Shader, Triangle::MSAA4>(shader, vp, zbuf, &color_buf);
 
-		for (int x = 0; x < width; ++x) {
-			for (int y = 0; y < height; ++y) {
-				image.set(x, y, color_t(color_buf.get_value(x, y)));
-			}
-		}
+		resolve(color_buf, image);
 	}
 
 
@@ -0,0 +1,103 @@
+#include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include "gl.h"
+#include "camera.h"
+#include "model.h"
+#include "texture.h"
+#include "sequence.h"
+
+const int width  = 800;
+const int height = 800;
+
+vec3 light_dir(1, 1, 1);
+vec3 center(0, -0.5, 0);
+vec3 up(0, 1, 0);
+
+class Shader : public IShader {
+public:
+	Model   *model    = nullptr;
+	Texture *diff_map = nullptr;
+	mat4f uniform_model;
+	mat4f uniform_view;
+	mat4f uniform_projection;
+
+	virtual vec4 vertex(int iface, int nthvert) {
+		varying_uv.set_col(nthvert, model->uv<float>(iface, nthvert));
+		varying_normal.set_col(nthvert, model->normal<float>(iface, nthvert));
+		vec4f gl_Vertex = uniform_model * vec4f(model->vert<float>(iface, nthvert), 1.f);
+		return vec4(uniform_projection * (uniform_view * gl_Vertex));
+	}
+
+	virtual std::optional<color_t> fragment(vec3 bar) {
+		vec2 frag_uv = interpolate(varying_uv, bar);
+		vec3 n = interpolate(varying_normal, bar).normalize();
+		float diff = std::max(0.0, dot(n, light_dir.normalize()));
+		color_t color = diff_map->sample(frag_uv, interpolate(varying_uv, bar_ddx), interpolate(varying_uv, bar_ddy));
+		return color * (0.2f + 0.8f * diff);
+	}
+
+	virtual int nvaryings() const {
+		return count_varyings(varying_uv, varying_normal);
+	}
+
+	virtual void save_varyings(int nthvert, double* out) const {
+		pack_varyings(out, nthvert, varying_uv, varying_normal);
+	}
+
+	virtual void load_varyings(int nthvert, const double* in) {
+		unpack_varyings(in, nthvert, varying_uv, varying_normal);
+	}
+
+	virtual std::unique_ptr<IShader> clone() const {
+		return std::make_unique<Shader>(*this);
+	}
+private:
+	mat<2, 3, float> varying_uv;
+	mat<3, 3, float> varying_normal;
+};
+
+// a turntable around the head, the number of frames is the first argument
+int main(int argc, char **argv) {
+	int nframes = argc > 1 ? std::atoi(argv[1]) : 8;
+
+	// loaded once for all the frames
+	Model *head  = new Model("../obj/african_head/african_head.obj");
+	head->cull_face(CULL_BACK);	// closed mesh, its back faces are always hidden
+	Model *floor = new Model("../obj/floor/floor.obj");
+	Texture head_diff("../obj/african_head/african_head_diffuse.tga");
+	Texture floor_diff("../obj/floor/floor_diffuse.tga");
+
+	mat4 head_model  = translate(mat4::identity(), vec3(0, -1.0, 0));
+	mat4 floor_model = scale(mat4::identity(), vec3(2, 2, 2));
+	floor_model = translate(floor_model, vec3(-1, 0, -1));
+	mat4 proj = perspective(radius(45), (float)width / (float)height, -0.1, -100.0);
+	mat4 vp   = viewport(0, 0, width, height);
+
+	CameraPath path = CameraPath::orbit(center, 4, 1.5, up, 1.0);
+	SequenceRenderer renderer(width, height, Triangle::MSAA4);
+	auto scene = [&](int /*frame*/, const Camera& camera, FrameDraws& draws) {
+		Shader shader;
+		shader.uniform_view = mat4f(camera.get_view_mat());
+		shader.uniform_projection = mat4f(proj);
+
+		shader.uniform_model = mat4f(head_model);
+		shader.diff_map = &head_diff;
+		shader.model = head;
+		draws.draw(*head, shader, vp);
+
+		shader.uniform_model = mat4f(floor_model);
+		shader.diff_map = &floor_diff;
+		shader.model = floor;
+		draws.draw(*floor, shader, vp);
+	};
+
+	auto t0 = std::chrono::steady_clock::now();
+	renderer.render(path, nframes, scene, "sequence_%03d.tga");
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	std::cout << nframes << " frames in " << sec << " s" << std::endl;
+
+	delete head;
+	delete floor;
+	return 0;
+}
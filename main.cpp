@@ -46,8 +46,8 @@ public:
 	mat4 uniform_proj;
 	virtual vec4 vertex(int iface, int nthvert) {
 		vec3 n = model->normal(iface, nthvert).normalize();
-		light_dir = light_dir.normalize();
-		varying_intensity[nthvert] = std::max(0.0, dot(n, light_dir)); // get diffuse lighting intensity
+		vec3 l = light_dir.normalize();
+		varying_intensity[nthvert] = std::max(0.0, dot(n, l)); // get diffuse lighting intensity
 		vec4 gl_Vertex = vec4(model->vert(iface, nthvert), 1.0);		// read the vertex from .obj file
 		return uniform_proj * uniform_view * uniform_model * gl_Vertex;		// transform it to screen coordinates
 	}
@@ -57,6 +57,22 @@ public:
 		color_t color = color_t(1, 1, 1) * intensity;
 		return std::optional<color_t>(color);
 	}
+
+	virtual int nvaryings() const {
+		return count_varyings(varying_intensity);
+	}
+
+	virtual void save_varyings(int nthvert, double* out) const {
+		pack_varyings(out, nthvert, varying_intensity);
+	}
+
+	virtual void load_varyings(int nthvert, const double* in) {
+		unpack_varyings(in, nthvert, varying_intensity);
+	}
+
+	virtual std::unique_ptr<IShader> clone() const {
+		return std::make_unique<Shader>(*this);
+	}
 private:
 	vec3 varying_intensity;		// writen by vertex shader, read by fragment shader
 };
@@ -80,7 +96,7 @@ int main() {
 	DepthBuffer zbuf(width, height, -std::numeric_limits<float>::max(), 4);
 	ColorBuffer color_buf(width, height, color_t(0, 0, 0, 0), 4);
 
-	cube->draw(shader, vp, zbuf, &color_buf, Triangle::MSAA4);
+	cube->draw<Shader, Triangle::MSAA4>(shader, vp, zbuf, &color_buf);
 
 	TGAImage image(width, height, TGAImage::RGB);
 	for (int x = 0; x < width; ++x) {
@@ -0,0 +1,86 @@
+#include "binning.h"
+
+TileBins::TileBins(int width, int height)
+	: w(width), h(height)
+	, cols((width + TILE_SIZE - 1) / TILE_SIZE)
+	, rows((height + TILE_SIZE - 1) / TILE_SIZE)
+	, bins(cols * rows) { }
+
+void TileBins::push(int iface, const Triangle &t, const int *v) {
+	const BBox& box = t.bbox();
+	if (box.right < 0 || box.top < 0 || box.left >= w || box.bottom >= h)
+		return;
+	int col0 = std::max(box.left, 0) / TILE_SIZE;
+	int col1 = std::min(box.right, w - 1) / TILE_SIZE;
+	int row0 = std::max(box.bottom, 0) / TILE_SIZE;
+	int row1 = std::min(box.top, h - 1) / TILE_SIZE;
+
+	int idx = tris.size();
+	tris.push_back(t);
+	tris.back().set_state(state);
+	faces.push_back(iface);
+	for (int j = 0; j < 3; ++j)
+		vidx.push_back(v ? v[j] : -1);
+	for (int r = row0; r <= row1; ++r)
+		for (int c = col0; c <= col1; ++c)
+			bins[r * cols + c].push_back(idx);
+}
+
+void TileBins::raster(IShader &shader, DepthBuffer &zbuf, ColorBuffer *color_buf, 
+					  Triangle::AA_Format aa_f) const {
+	dispatch_aa(aa_f, [&](auto aa) {
+		raster<IShader, decltype(aa)::value>(shader, zbuf, color_buf);
+	});
+}
+
+void TileBins::raster(DepthBuffer &zbuf, Triangle::AA_Format aa_f) const {
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int i = 0; i < ntiles(); ++i) {
+		BBox rect = tile_rect(i);
+		for (int j: bins[i])
+			tris[j].raster(zbuf, aa_f, rect);
+	}
+}
+
+void TileBins::raster(IdBuffer &id_buf, int draw, DepthBuffer &zbuf, 
+					  Triangle::AA_Format aa_f) const {
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int i = 0; i < ntiles(); ++i) {
+		BBox rect = tile_rect(i);
+		for (int j: bins[i])
+			tris[j].raster(id_buf, VisId{draw, faces[j]}, zbuf, aa_f, rect);
+	}
+}
+
+void TileBins::set_varyings(std::vector<double> &&v, int nvaryings) {
+	assert(nvaryings >= 0);
+	varyings = std::move(v);
+	nvarying = nvaryings;
+}
+
+void TileBins::draw(IShader &shader, DepthBuffer &zbuf, ColorBuffer *color_buf, 
+					Triangle::AA_Format aa_f) {
+	dispatch_aa(aa_f, [&](auto aa) {
+		draw<IShader, decltype(aa)::value>(shader, zbuf, color_buf);
+	});
+}
+
+RenderState TileBins::equal_pass(const RenderState &s) {
+	// only the samples that kept the depth of the first pass, which is already written
+	RenderState ret = s;
+	ret.depth_func  = DEPTH_EQUAL;
+	ret.depth_write = false;
+	return ret;
+}
+
+void TileBins::set_state(const RenderState &s) {
+	state = s;
+	for (Triangle& t: tris)
+		t.set_state(s);
+}
+
+BBox TileBins::tile_rect(int idx) const {
+	int x = idx % cols * TILE_SIZE;
+	int y = idx / cols * TILE_SIZE;
+	return BBox{x, y, std::min(x + TILE_SIZE, w) - 1, std::min(y + TILE_SIZE, h) - 1};
+}
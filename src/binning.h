@@ -0,0 +1,151 @@
+#pragma once
+#include <vector>
+#include "gl.h"
+#include "buffer.h"
+#include "triangle.h"
+
+const int TILE_SIZE = 64;
+
+/**
+ * geometry work of a draw
+ * 	transforms : vertex shader runs, with those of a raster that has no saved varyings
+ * 				 and runs it again for the corners of every triangle in every tile
+ * 	hits       : triangle corners of the vertex stage that reused a transformed vertex
+ * 	culled     : faces culled by their winding
+ * 	outside    : faces outside of the view frustum
+ */
+struct DrawStats {
+	int64_t transforms = 0;
+	int64_t hits = 0;
+	int64_t culled = 0;
+	int64_t outside = 0;
+};
+
+/**
+ * sort set up triangles into TILE_SIZE x TILE_SIZE screen tiles and
+ * rasterize the tiles in parallel.
+ * every tile keeps the submission order of its triangles, so blending
+ * gives the same result as a serial draw.
+ */
+class TileBins {
+public:
+	TileBins(int width, int height);
+	// t must be set up, iface is passed back to shader.vertex() before raster.
+	// vidx is the indices of t's vertexs in the varyings, if set
+	void push(int iface, const Triangle& t, const int* vidx = nullptr);
+	// the saved varyings of the vertexs, restored by load_varyings() instead of running vertex()
+	void set_varyings(std::vector<double>&& varyings, int nvaryings);
+	void set_stats(const DrawStats& s) { dstats = s; }
+	// render state of the triangles pushed after and of those already binned
+	void set_state(const RenderState& s);
+	const RenderState& render_state() const { return state; }
+	// stats of the vertex stage, raster() adds the vertex shader runs of the tiles
+	const DrawStats& stats() const { return dstats; }
+	void raster(IShader& shader, DepthBuffer& zbuf, ColorBuffer* color_buf, 
+				Triangle::AA_Format aa_f) const;
+	template<typename ShaderT, Triangle::AA_Format AA>
+	void raster(ShaderT& shader, DepthBuffer& zbuf, ColorBuffer* color_buf) const;
+	// raster() as a draw with the render state, in two passes if it has prepass
+	void draw(IShader& shader, DepthBuffer& zbuf, ColorBuffer* color_buf, Triangle::AA_Format aa_f);
+	template<typename ShaderT, Triangle::AA_Format AA>
+	void draw(ShaderT& shader, DepthBuffer& zbuf, ColorBuffer* color_buf);
+	// rasterize the depth only, also what the above do without late_z and a color buffer or color_mask
+	void raster(DepthBuffer& zbuf, Triangle::AA_Format aa_f) const;
+	// rasterize the ids of the faces only, as draw
+	void raster(IdBuffer& id_buf, int draw, DepthBuffer& zbuf, Triangle::AA_Format aa_f) const;
+	int  ntiles() const { return cols * rows; }
+	BBox tile_rect(int idx) const;
+private:
+	// the state of the shading pass after a prepass
+	static RenderState equal_pass(const RenderState& s);
+	template<typename ShaderT, Triangle::AA_Format AA>
+	void raster_tile(int idx, ShaderT& shader, DepthBuffer& zbuf, ColorBuffer* color_buf) const;
+
+	int w;
+	int h;
+	int cols;
+	int rows;
+	std::vector<Triangle> tris{};
+	std::vector<int> faces{};				// face index of each triangle
+	std::vector<int> vidx{};				// 3 vertex indices of each triangle
+	std::vector<double> varyings{};
+	int nvarying = -1;						// doubles per vertex, -1 if none saved
+	mutable DrawStats dstats{};
+	RenderState state{};
+	std::vector<std::vector<int>> bins{};	// per-tile indices in tris
+};
+
+/**
+ * every raster thread needs its own copy of the shader:
+ * 	IShader : made by clone(), on the calling thread if it returns nullptr
+ * 	others  : made by the copy constructor, on the calling thread if there is none
+ */
+template<typename ShaderT, Triangle::AA_Format AA>
+void TileBins::raster(ShaderT &shader, DepthBuffer &zbuf, ColorBuffer *color_buf) const {
+	if ((!color_buf || !state.color_mask) && !shader.late_z) {
+		raster(zbuf, AA);
+		return;
+	}
+	if (nvarying < 0) {
+		for (const auto& bin: bins)
+			dstats.transforms += 3 * int64_t(bin.size());
+	}
+	if constexpr (std::is_same_v<ShaderT, IShader>) {
+		std::unique_ptr<IShader> first = shader.clone();
+		if (first) {
+			#pragma omp parallel
+			{
+				// the copy made by the check goes to the first thread, the others clone their own
+				std::unique_ptr<IShader> local;
+				#pragma omp critical
+				local = std::move(first);
+				if (!local)
+					local = shader.clone();
+				#pragma omp for schedule(dynamic, 1)
+				for (int i = 0; i < ntiles(); ++i)
+					raster_tile<IShader, AA>(i, *local, zbuf, color_buf);
+			}
+			return;
+		}
+	} else if constexpr (std::is_copy_constructible_v<ShaderT>) {
+		#pragma omp parallel
+		{
+			ShaderT local(shader);
+			#pragma omp for schedule(dynamic, 1)
+			for (int i = 0; i < ntiles(); ++i)
+				raster_tile<ShaderT, AA>(i, local, zbuf, color_buf);
+		}
+		return;
+	}
+	for (int i = 0; i < ntiles(); ++i)
+		raster_tile<ShaderT, AA>(i, shader, zbuf, color_buf);
+}
+
+template<typename ShaderT, Triangle::AA_Format AA>
+void TileBins::draw(ShaderT &shader, DepthBuffer &zbuf, ColorBuffer *color_buf) {
+	if (!state.prepass || !color_buf) {
+		raster<ShaderT, AA>(shader, zbuf, color_buf);
+		return;
+	}
+	RenderState s = state;
+	raster<ShaderT, AA>(shader, zbuf, nullptr);
+	set_state(equal_pass(s));
+	raster<ShaderT, AA>(shader, zbuf, color_buf);
+	set_state(s);
+}
+
+template<typename ShaderT, Triangle::AA_Format AA>
+void TileBins::raster_tile(int idx, ShaderT &shader, DepthBuffer &zbuf, ColorBuffer *color_buf) const {
+	BBox rect = tile_rect(idx);
+	for (int i: bins[idx]) {
+		// reload the varyings of this face
+		if (nvarying < 0) {
+			for (int j = 0; j < 3; ++j)
+				shader_vertex(shader, faces[i], j);
+		} else if (nvarying > 0) {
+			for (int j = 0; j < 3; ++j)
+				shader.load_varyings(j, &varyings[size_t(vidx[i * 3 + j]) * nvarying]);
+		}
+		tris[i].template raster<ShaderT, AA>(shader, zbuf, color_buf, rect);
+	}
+}
@@ -1,53 +1,357 @@
 #pragma once
+#include <new>
+#include <memory>
+#include <mutex>
 #include <vector>
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <iostream>
 #include "tgaimage.h"
 
+// std::allocator with over-aligned storage, so rows can be loaded with SIMD
+template<typename T, std::size_t Align> struct AlignedAllocator {
+	using value_type = T;
+	template<typename U> struct rebind { using other = AlignedAllocator<U, Align>; };
+
+	AlignedAllocator() = default;
+	template<typename U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+	T* allocate(std::size_t n) {
+		return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+	}
+	void deallocate(T* p, std::size_t) { ::operator delete(p, std::align_val_t(Align)); }
+	template<typename U> bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+	template<typename U> bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+};
+
+// a run of contiguous elements inside a buffer
+template<typename T> struct Span {
+	T*  ptr = nullptr;
+	int n   = 0;
+	T*  begin() const { return ptr; }
+	T*  end()   const { return ptr + n; }
+	int size()  const { return n; }
+	T&  operator[](const int i) const { assert(i >= 0 && i < n); return ptr[i]; }
+};
+
+/**
+ * every sample index is stored in its own plane, all the planes live in a
+ * single allocation. the pixels of a plane are ordered by layout:
+ * 	LINEAR : row by row
+ * 	TILED  : BUFFER_TILE x BUFFER_TILE tiles, row by row inside a tile,
+ * 			 a tile is one cache-friendly block of memory
+ * width and height are padded to BUFFER_TILE, so a row of a tile is
+ * always BUFFER_TILE contiguous elements in both layouts.
+ *
+ * clear() is lazy: it only bumps a generation, a BUFFER_TILE x BUFFER_TILE block
+ * whose stamp is older is filled with the clear value on first touch, in all the
+ * sample planes. set(), row(), tile() and address() fill the blocks they reach,
+ * get() and get_value() read the clear value of a pending block without filling it.
+ * blocks are filled by whoever touches them first, so a parallel pass that isn't
+ * split along blocks, like rows, calls flush() before it starts.
+ */
+const int BUFFER_TILE = 8;
+
 template<typename T> class Buffer {
 public:
+	enum Layout { LINEAR, TILED };
+	using value_type = T;
+
 	Buffer() = default;
-	Buffer(int width, int height, T fill, int simples = 1)
-		: w(width), h(height), simples(simples), 
-		data(width * height, std::vector<T>(simples, fill)) {}
+	Buffer(int width, int height, T fill, int simples = 1, Layout layout = LINEAR)
+		: w(width), h(height), simples(simples), order(layout)
+		, pw((width  + BUFFER_TILE - 1) / BUFFER_TILE * BUFFER_TILE)
+		, ph((height + BUFFER_TILE - 1) / BUFFER_TILE * BUFFER_TILE)
+		, data(size_t(pw) * ph * simples, fill)
+		, clear_value(fill), stamps(size_t(pw / BUFFER_TILE) * (ph / BUFFER_TILE), 0) {}
+	// every sample becomes fill, in O(1), see above
+	void clear(T fill);
+	// fill all the blocks still pending from the last clear
+	void flush();
 	T 	 get(int x, int y, int nthsimple);
 	void set(int x, int y, int nthsimple, T t);
 	// return average value in (x, y)
 	T    get_value(int x, int y);
+	// the whole row y of a sample plane, LINEAR layout only
+	Span<T> row(int y, int nthsimple);
+	// the tile holding (x, y) of a sample plane, TILED layout only
+	Span<T> tile(int x, int y, int nthsimple);
+	// address of (x, y), the rest of its tile row follows contiguously
+	T*   address(int x, int y, int nthsimple);
 	int  simple_num() { return simples; }
 	int  width()  { return w; }
 	int  height() { return h; }
+	Layout layout() { return order; }
 private:
+	size_t index(int x, int y, int nthsimple) const;
+	size_t block(int x, int y) const { return size_t(y / BUFFER_TILE) * (pw / BUFFER_TILE) + x / BUFFER_TILE; }
+	bool   pending(int x, int y) const { return stamps[block(x, y)] != generation; }
+	// fill the block holding (x, y) if it is pending
+	void   touch(int x, int y) { if (pending(x, y)) fill_block(x, y); }
+	void   fill_block(int x, int y);
+
 	int w;
 	int h;
 	int simples;
-	std::vector<std::vector<T>> data;
+	Layout order = LINEAR;
+	int pw;		// padded width
+	int ph;		// padded height
+	std::vector<T, AlignedAllocator<T, 64>> data;
+	T clear_value{};
+	uint32_t generation = 0;			// of the last clear
+	std::vector<uint32_t> stamps{};		// per block, the generation it was filled for
 };
 
-template <typename T> 
+template <typename T>
+inline void Buffer<T>::clear(T fill) {
+	clear_value = fill;
+	if (++generation == 0) {
+		// the stamps would repeat, fill everything now once in 2^32 clears
+		std::fill(data.begin(), data.end(), fill);
+		std::fill(stamps.begin(), stamps.end(), 0);
+	}
+}
+
+template <typename T>
+inline void Buffer<T>::flush() {
+	int bcols = pw / BUFFER_TILE, nblocks = stamps.size();
+	#pragma omp parallel for schedule(static)
+	for (int b = 0; b < nblocks; ++b) {
+		if (stamps[b] != generation)
+			fill_block(b % bcols * BUFFER_TILE, b / bcols * BUFFER_TILE);
+	}
+}
+
+template <typename T>
+inline void Buffer<T>::fill_block(int x, int y) {
+	x -= x % BUFFER_TILE;
+	y -= y % BUFFER_TILE;
+	for (int i = 0; i < simples; ++i) {
+		for (int j = 0; j < BUFFER_TILE; ++j) {
+			T* p = data.data() + index(x, y + j, i);
+			std::fill(p, p + BUFFER_TILE, clear_value);
+		}
+	}
+	stamps[block(x, y)] = generation;
+}
+
+template <typename T>
+inline size_t Buffer<T>::index(int x, int y, int nthsimple) const {
+	size_t plane = size_t(pw) * ph * nthsimple;
+	if (order == LINEAR)
+		return plane + size_t(y) * pw + x;
+	int tx = x / BUFFER_TILE, ty = y / BUFFER_TILE;
+	size_t t = size_t(ty) * (pw / BUFFER_TILE) + tx;
+	return plane + t * BUFFER_TILE * BUFFER_TILE + (y % BUFFER_TILE) * BUFFER_TILE + x % BUFFER_TILE;
+}
+
+template <typename T>
 inline T Buffer<T>::get(int x, int y, int nthsimple) {
 	assert(nthsimple >= 0 && nthsimple < simples);
-	return data[y * w + x][nthsimple];
+	if (pending(x, y))
+		return clear_value;
+	return data[index(x, y, nthsimple)];
 }
 
 template <typename T>
 inline void Buffer<T>::set(int x, int y, int nthsimple, T t) {
 	assert(nthsimple >= 0 && nthsimple < simples);
-	data[y * w + x][nthsimple] = t;
+	touch(x, y);
+	data[index(x, y, nthsimple)] = t;
 }
 
 template <typename T> inline T Buffer<T>::get_value(int x, int y) {
 	assert(x >= 0 && x < w);
 	assert(y >= 0 && y < h);
-	std::vector<T>& v = data[y * w + x];
-	T ret = v[0] * (1.0 / simples);
-	for (int i = 1; i < v.size(); ++i)
-		ret = ret + v[i] * (1.0 / simples);
-	// for (T &t: v) {
-	// 	ret = ret + t * (1.0 / simples);
-	// }
+	if (pending(x, y))
+		return clear_value;
+	size_t idx   = index(x, y, 0);
+	size_t plane = size_t(pw) * ph;
+	T ret = data[idx] * (1.0 / simples);
+	for (int i = 1; i < simples; ++i)
+		ret = ret + data[idx + i * plane] * (1.0 / simples);
 	return ret;
 }
 
-using DepthBuffer = Buffer<float>;
-using ColorBuffer = Buffer<color_t>;
\ No newline at end of file
+template <typename T>
+inline Span<T> Buffer<T>::row(int y, int nthsimple) {
+	assert(order == LINEAR);
+	assert(y >= 0 && y < h);
+	for (int x = 0; x < w; x += BUFFER_TILE)
+		touch(x, y);
+	return Span<T>{data.data() + index(0, y, nthsimple), w};
+}
+
+template <typename T>
+inline Span<T> Buffer<T>::tile(int x, int y, int nthsimple) {
+	assert(order == TILED);
+	assert(x >= 0 && x < w && y >= 0 && y < h);
+	x -= x % BUFFER_TILE;
+	y -= y % BUFFER_TILE;
+	touch(x, y);
+	return Span<T>{data.data() + index(x, y, nthsimple), BUFFER_TILE * BUFFER_TILE};
+}
+
+template <typename T>
+inline T* Buffer<T>::address(int x, int y, int nthsimple) {
+	assert(nthsimple >= 0 && nthsimple < simples);
+	assert(x >= 0 && x < pw && y >= 0 && y < ph);
+	touch(x, y);
+	return data.data() + index(x, y, nthsimple);
+}
+
+/**
+ * depth buffer with a hierarchical level: the farthest and the nearest depth
+ * of every BUFFER_TILE x BUFFER_TILE block, over all of its samples.
+ * the farthest depth never overestimates the block, so a triangle whose
+ * nearest depth isn't greater can skip the whole block.
+ * writes through address() must be followed by update_block().
+ */
+class DepthBuffer : public Buffer<float> {
+public:
+	DepthBuffer() = default;
+	DepthBuffer(int width, int height, float fill, int simples = 1, Layout layout = LINEAR)
+		: Buffer<float>(width, height, fill, simples, layout)
+		, bw((width  + BUFFER_TILE - 1) / BUFFER_TILE)
+		, bh((height + BUFFER_TILE - 1) / BUFFER_TILE)
+		, zmin(size_t(bw) * bh, fill), zmax(size_t(bw) * bh, fill) {}
+	void  set(int x, int y, int nthsimple, float t);
+	void  clear(float fill);
+	// nearest and farthest sample of (x, y), the resolve of a depth buffer. unlike
+	// get_value they are depths some surface really has, not a blend across an edge
+	float get_nearest(int x, int y);
+	float get_farthest(int x, int y);
+	// depth range of the block holding (x, y)
+	float farthest(int x, int y) const { return zmin[block(x, y)]; }
+	float nearest(int x, int y)  const { return zmax[block(x, y)]; }
+	// rescan the samples of the block holding (x, y)
+	void  update_block(int x, int y);
+private:
+	size_t block(int x, int y) const { return size_t(y / BUFFER_TILE) * bw + x / BUFFER_TILE; }
+
+	int bw;		// blocks per row
+	int bh;
+	std::vector<float> zmin;
+	std::vector<float> zmax;
+};
+
+inline void DepthBuffer::set(int x, int y, int nthsimple, float t) {
+	Buffer<float>::set(x, y, nthsimple, t);
+	size_t b = block(x, y);
+	zmin[b] = std::min(zmin[b], t);
+	zmax[b] = std::max(zmax[b], t);
+}
+
+inline void DepthBuffer::clear(float fill) {
+	Buffer<float>::clear(fill);
+	std::fill(zmin.begin(), zmin.end(), fill);
+	std::fill(zmax.begin(), zmax.end(), fill);
+}
+
+inline float DepthBuffer::get_nearest(int x, int y) {
+	assert(x >= 0 && x < width() && y >= 0 && y < height());
+	float ret = get(x, y, 0);
+	for (int i = 1; i < simple_num(); ++i)
+		ret = std::max(ret, get(x, y, i));
+	return ret;
+}
+
+inline float DepthBuffer::get_farthest(int x, int y) {
+	assert(x >= 0 && x < width() && y >= 0 && y < height());
+	float ret = get(x, y, 0);
+	for (int i = 1; i < simple_num(); ++i)
+		ret = std::min(ret, get(x, y, i));
+	return ret;
+}
+
+inline void DepthBuffer::update_block(int x, int y) {
+	x -= x % BUFFER_TILE;
+	y -= y % BUFFER_TILE;
+	int rows = std::min(BUFFER_TILE, height() - y);
+	int cols = std::min(BUFFER_TILE, width()  - x);
+	float lo = std::numeric_limits<float>::max();
+	float hi = -std::numeric_limits<float>::max();
+	for (int i = 0; i < simple_num(); ++i) {
+		for (int j = 0; j < rows; ++j) {
+			const float* p = address(x, y + j, i);
+			for (int k = 0; k < cols; ++k) {
+				lo = std::min(lo, p[k]);
+				hi = std::max(hi, p[k]);
+			}
+		}
+	}
+	size_t b = block(x, y);
+	zmin[b] = lo;
+	zmax[b] = hi;
+}
+
+using ColorBuffer = Buffer<color_t>;
+
+// which face of which draw covers a sample, draw < 0 if none
+struct VisId {
+	int32_t draw = -1;
+	int32_t face = -1;
+	bool operator==(const VisId& o) const { return draw == o.draw && face == o.face; }
+	bool operator!=(const VisId& o) const { return !(*this == o); }
+};
+using IdBuffer = Buffer<VisId>;
+
+/**
+ * render targets kept across frames. acquire() hands out a released buffer of the same
+ * size, sample count and layout, cleared to fill in O(1), and only allocates if there
+ * is none. acquire() and release() may be called from any thread.
+ */
+template<typename BufferT> class BufferPool {
+public:
+	using Layout = typename BufferT::Layout;
+	std::unique_ptr<BufferT> acquire(int width, int height, typename BufferT::value_type fill, 
+									 int simples = 1, Layout layout = BufferT::LINEAR);
+	void release(std::unique_ptr<BufferT> buf);
+	// free the released buffers
+	void trim();
+	// released buffers waiting for an acquire()
+	int  idle() const;
+private:
+	mutable std::mutex lock;
+	std::vector<std::unique_ptr<BufferT>> spare{};
+};
+
+template <typename BufferT>
+inline std::unique_ptr<BufferT> BufferPool<BufferT>::acquire(int width, int height, 
+		typename BufferT::value_type fill, int simples, Layout layout) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (size_t i = 0; i < spare.size(); ++i) {
+			BufferT& b = *spare[i];
+			if (b.width() != width || b.height() != height || b.simple_num() != simples || b.layout() != layout)
+				continue;
+			std::unique_ptr<BufferT> ret = std::move(spare[i]);
+			spare.erase(spare.begin() + i);
+			ret->clear(fill);
+			return ret;
+		}
+	}
+	return std::make_unique<BufferT>(width, height, fill, simples, layout);
+}
+
+template <typename BufferT>
+inline void BufferPool<BufferT>::release(std::unique_ptr<BufferT> buf) {
+	if (!buf)
+		return;
+	std::lock_guard<std::mutex> guard(lock);
+	spare.push_back(std::move(buf));
+}
+
+template <typename BufferT>
+inline void BufferPool<BufferT>::trim() {
+	std::lock_guard<std::mutex> guard(lock);
+	spare.clear();
+}
+
+template <typename BufferT>
+inline int BufferPool<BufferT>::idle() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return spare.size();
+}
@@ -1,6 +1,64 @@
+#include <cmath>
+#include <algorithm>
 #include "camera.h"
 #include "gl.h"
 
-mat4 Camera::get_view_mat() {
+mat4 Camera::get_view_mat() const {
 	return lookat(pos, target, up);
 }
+
+void CameraPath::add_key(double time, const Camera &camera) {
+	auto it = std::upper_bound(keys.begin(), keys.end(), time, 
+							   [](double t, const Key& k) { return t < k.time; });
+	keys.insert(it, Key{time, camera});
+}
+
+const Camera& CameraPath::key(int i) const {
+	int n = keys.size();
+	if (looping && n > 2) {
+		// the last key is the first one again
+		if (i < 0)  i += n - 1;
+		if (i >= n) i -= n - 1;
+	}
+	return keys[std::clamp(i, 0, n - 1)].camera;
+}
+
+Camera CameraPath::at(double time) const {
+	if (keys.empty())
+		return Camera();
+	if (time <= keys.front().time || keys.size() == 1)
+		return keys.front().camera;
+	if (time >= keys.back().time)
+		return keys.back().camera;
+
+	int i = std::upper_bound(keys.begin(), keys.end(), time, 
+							 [](double t, const Key& k) { return t < k.time; }) - keys.begin() - 1;
+	double span = keys[i + 1].time - keys[i].time;
+	double s = span > 0 ? (time - keys[i].time) / span : 0;
+	auto spline = [&](vec3 p0, vec3 p1, vec3 p2, vec3 p3) {
+		return 0.5 * ((2 * p1) + (p2 - p0) * s + (2 * p0 - 5 * p1 + 4 * p2 - p3) * (s * s)
+					  + (3 * p1 - p0 - 3 * p2 + p3) * (s * s * s));
+	};
+	const Camera &c0 = key(i - 1), &c1 = key(i), &c2 = key(i + 1), &c3 = key(i + 2);
+	vec3 pos    = spline(c0.get_pos(), c1.get_pos(), c2.get_pos(), c3.get_pos());
+	vec3 target = spline(c0.get_target(), c1.get_target(), c2.get_target(), c3.get_target());
+	vec3 up     = (c1.get_up() + (c2.get_up() - c1.get_up()) * s).normalize();
+	return Camera(pos, target, up);
+}
+
+CameraPath CameraPath::orbit(const vec3 &center, double radius, double height, const vec3 &up, 
+							 double duration, int nkeys) {
+	// two directions perpendicular to up span the circle
+	vec3 n = normalized(up);
+	vec3 a = std::abs(n.x) < 0.9 ? vec3(1, 0, 0) : vec3(0, 1, 0);
+	vec3 u = normalized(cross(n, a));
+	vec3 v = cross(n, u);
+	CameraPath path;
+	for (int i = 0; i <= nkeys; ++i) {
+		double angle = 2 * M_PI * (i % nkeys) / nkeys;
+		vec3 pos = center + n * height + (u * std::cos(angle) + v * std::sin(angle)) * radius;
+		path.add_key(duration * i / nkeys, Camera(pos, center, up));
+	}
+	path.set_loop(true);
+	return path;
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <vector>
 #include "geometry.h"
 
 class Camera {
@@ -6,9 +7,42 @@ public:
 	Camera() = default;
 	Camera(vec3 pos_, vec3 target_, vec3 up_)
 		: pos(pos_), target(target_), up(up_) { }
-	mat4 get_view_mat();
+	mat4 get_view_mat() const;
+	vec3 get_pos()    const { return pos; }
+	vec3 get_target() const { return target; }
+	vec3 get_up()     const { return up; }
 private:
 	vec3 pos;
 	vec3 target;
 	vec3 up;
-};
\ No newline at end of file
+};
+
+/**
+ * a camera animated by keyframes. position and target follow a Catmull-Rom spline
+ * through the keys, uniform per segment, up is interpolated linearly and normalized.
+ * a looping path has the same first and last key and wraps its tangents around them.
+ */
+class CameraPath {
+public:
+	// keys are kept sorted by time
+	void add_key(double time, const Camera& camera);
+	void set_loop(bool loop) { looping = loop; }
+	// the camera at time, clamped to the first and the last key
+	Camera at(double time) const;
+	double start() const { return keys.empty() ? 0 : keys.front().time; }
+	double end()   const { return keys.empty() ? 0 : keys.back().time; }
+	int    nkeys() const { return keys.size(); }
+	// one turn around center at radius and height over it in duration, a looping path
+	static CameraPath orbit(const vec3& center, double radius, double height, const vec3& up, 
+							double duration, int nkeys = 12);
+private:
+	struct Key {
+		double time;
+		Camera camera;
+	};
+	// key i of the spline, past the ends it repeats them or wraps if looping
+	const Camera& key(int i) const;
+
+	std::vector<Key> keys{};
+	bool looping = false;
+};
@@ -0,0 +1,439 @@
+#include <cmath>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "filter.h"
+#include "tgaimage.h"
+#include "buffer.h"
+#include "triangle.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FILTER_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// output rows handed to one thread at a time, a block also filters the kh - 1 source rows around it
+const int FILTER_BLOCK = 32;
+
+/**
+ * the row loops of the filters, in avx2 and in plain c++
+ * 	axpy   : acc[i] += k * src[i]
+ * 	widen  : bytes to floats
+ * 	narrow : floats to bytes, rounded and clamped
+ * 	pack   : narrow rgba pixels to the bgr(a) or grayscale bytes of a TGAImage
+ */
+struct RowKernels {
+	void (*axpy)(float* acc, const float* src, float k, int n);
+	void (*widen)(float* dst, const std::uint8_t* src, int n);
+	void (*narrow)(std::uint8_t* dst, const float* src, int n);
+	void (*pack)(std::uint8_t* dst, const float* rgba, int npixels, int bpp);
+};
+
+// to nearest, ties to even as _mm256_cvtps_epi32 does, so both paths give the same bytes
+std::uint8_t to_byte(float v) {
+	return std::uint8_t(std::nearbyint(std::clamp(v, 0.f, 255.f)));
+}
+
+void axpy_scalar(float* acc, const float* src, float k, int n) {
+	for (int i = 0; i < n; ++i)
+		acc[i] += k * src[i];
+}
+
+void widen_scalar(float* dst, const std::uint8_t* src, int n) {
+	for (int i = 0; i < n; ++i)
+		dst[i] = src[i];
+}
+
+void narrow_scalar(std::uint8_t* dst, const float* src, int n) {
+	for (int i = 0; i < n; ++i)
+		dst[i] = to_byte(src[i]);
+}
+
+void pack_scalar(std::uint8_t* dst, const float* rgba, int npixels, int bpp) {
+	for (int x = 0; x < npixels; ++x, rgba += 4, dst += bpp) {
+		std::uint8_t bgra[4];
+		const int order[4] = {2, 1, 0, 3};
+		for (int c = 0; c < 4; ++c)
+			bgra[c] = to_byte(rgba[order[c]]);
+		std::memcpy(dst, bgra, bpp);
+	}
+}
+
+#ifdef FILTER_AVX2
+__attribute__((target("avx2,fma")))
+void axpy_avx2(float* acc, const float* src, float k, int n) {
+	__m256 vk = _mm256_set1_ps(k);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(acc + i, _mm256_fmadd_ps(vk, _mm256_loadu_ps(src + i), _mm256_loadu_ps(acc + i)));
+	axpy_scalar(acc + i, src + i, k, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+void widen_avx2(float* dst, const std::uint8_t* src, int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+		_mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b)));
+	}
+	widen_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+void narrow_avx2(std::uint8_t* dst, const float* src, int n) {
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		// round, then the saturating packs clamp to [0, 255]
+		__m256i a = _mm256_cvtps_epi32(_mm256_loadu_ps(src + i));
+		__m256i b = _mm256_cvtps_epi32(_mm256_loadu_ps(src + i + 8));
+		__m256i w = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8);
+		__m128i p = _mm_packus_epi16(_mm256_castsi256_si128(w), _mm256_extracti128_si256(w, 1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), p);
+	}
+	narrow_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+void pack_avx2(std::uint8_t* dst, const float* rgba, int npixels, int bpp) {
+	// rgba bytes of 4 pixels to bgra, bgr or b
+	const __m128i order[5] = {
+		{}, _mm_setr_epi8(2, 6, 10, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1), {},
+		_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1),
+		_mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15),
+	};
+	if (bpp != 1 && bpp != 3 && bpp != 4)
+		return pack_scalar(dst, rgba, npixels, bpp);
+	int x = 0;
+	for (; x + 4 <= npixels; x += 4) {
+		__m256i a = _mm256_cvtps_epi32(_mm256_loadu_ps(rgba + 4 * x));
+		__m256i b = _mm256_cvtps_epi32(_mm256_loadu_ps(rgba + 4 * x + 8));
+		__m256i w = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8);
+		__m128i p = _mm_packus_epi16(_mm256_castsi256_si128(w), _mm256_extracti128_si256(w, 1));
+		alignas(16) std::uint8_t out[16];
+		_mm_store_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(p, order[bpp]));
+		std::memcpy(dst + x * bpp, out, 4 * bpp);
+	}
+	pack_scalar(dst + x * bpp, rgba + 4 * x, npixels - x, bpp);
+}
+#endif
+
+const RowKernels& row_kernels() {
+	static const RowKernels scalar{axpy_scalar, widen_scalar, narrow_scalar, pack_scalar};
+#ifdef FILTER_AVX2
+	static const RowKernels avx2{axpy_avx2, widen_avx2, narrow_avx2, pack_avx2};
+	static const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	return has_avx2 ? avx2 : scalar;
+#else
+	return scalar;
+#endif
+}
+
+// the pixel a coordinate outside [0, n) reads, -1 for zero
+int edge_index(int i, int n, EdgeMode edge) {
+	if (i >= 0 && i < n)
+		return i;
+	switch (edge) {
+	case EDGE_ZERO:
+		return -1;
+	case EDGE_WRAP:
+		return (i % n + n) % n;
+	case EDGE_MIRROR: {
+		int period = 2 * n;
+		i = (i % period + period) % period;
+		return i < n ? i : period - 1 - i;
+	}
+	default:	// EDGE_KEEP never uses the value, clamp it
+		return std::clamp(i, 0, n - 1);
+	}
+}
+
+/**
+ * source row y as floats with rx pixels of padding on both sides, so a tap
+ * at offset i of pixel x is element (x + i) * bpp + c
+ */
+void padded_row(const TGAImage& image, int y, int rx, EdgeMode edge, float* out) {
+	int w = image.width(), bpp = image.bytespp();
+	int sy = edge_index(y, image.height(), edge);
+	if (sy < 0) {
+		std::fill(out, out + (w + 2 * rx) * bpp, 0.f);
+		return;
+	}
+	const std::uint8_t* src = image.buffer() + size_t(sy) * w * bpp;
+	float* dst = out + rx * bpp;
+	row_kernels().widen(dst, src, w * bpp);
+	// the padding
+	auto pad = [&](int x) {
+		int sx = edge_index(x, w, edge);
+		for (int c = 0; c < bpp; ++c)
+			dst[x * bpp + c] = sx < 0 ? 0.f : src[sx * bpp + c];
+	};
+	for (int x = -rx; x < 0; ++x)
+		pad(x);
+	for (int x = w; x < w + rx; ++x)
+		pad(x);
+}
+
+// round, clamp and store row y, EDGE_KEEP copies the border pixels from the source
+void store_row(const TGAImage& image, int y, int rx, int ry, EdgeMode edge, const float* acc, TGAImage& out) {
+	int w = image.width(), h = image.height(), bpp = image.bytespp();
+	size_t offset = size_t(y) * w * bpp;
+	std::uint8_t* dst = out.buffer() + offset;
+	row_kernels().narrow(dst, acc, w * bpp);
+	if (edge != EDGE_KEEP)
+		return;
+	const std::uint8_t* src = image.buffer() + offset;
+	if (y < ry || y >= h - ry) {
+		std::memcpy(dst, src, w * bpp);
+		return;
+	}
+	int n = std::min(rx, w) * bpp;
+	std::memcpy(dst, src, n);
+	std::memcpy(dst + (w * bpp - n), src + (w * bpp - n), n);
+}
+
+// kernel = column * row if it has rank one
+bool separate(const float* kernel, int kw, int kh, std::vector<float>& kx, std::vector<float>& ky) {
+	// the largest weight gives the best conditioned factors
+	int p = std::max_element(kernel, kernel + kw * kh, [](float a, float b) {
+		return std::abs(a) < std::abs(b);
+	}) - kernel;
+	float pivot = kernel[p];
+	if (pivot == 0)
+		return false;
+	int pi = p % kw, pj = p / kw;
+	kx.assign(kernel + pj * kw, kernel + pj * kw + kw);
+	ky.resize(kh);
+	for (int j = 0; j < kh; ++j)
+		ky[j] = kernel[j * kw + pi] / pivot;
+	for (int j = 0; j < kh; ++j)
+		for (int i = 0; i < kw; ++i)
+			if (std::abs(kx[i] * ky[j] - kernel[j * kw + i]) > 1e-6f * std::abs(pivot))
+				return false;
+	return true;
+}
+
+/**
+ * the two passes of a separable convolution of h rows of n = w * bpp floats,
+ * the source and the destination are given by
+ * 	read(y, out)  : source row y with kw / 2 pixels of padding on both sides
+ * 	store(y, acc) : filtered row y
+ */
+template<typename ReadF, typename StoreF>
+void separable_passes(int w, int h, int bpp, const float* kx, int kw, const float* ky, int kh,
+					  ReadF read, StoreF store) {
+	int rx = kw / 2, ry = kh / 2;
+	int n = w * bpp;
+	int nblocks = (h + FILTER_BLOCK - 1) / FILTER_BLOCK;
+	auto axpy = row_kernels().axpy;
+
+	#pragma omp parallel
+	{
+		std::vector<float> padded((w + 2 * rx) * bpp);
+		std::vector<float> ring(size_t(kh) * n);	// the last kh horizontally filtered rows
+		std::vector<float> acc(n);
+		auto filter_row = [&](int y, int base) {
+			read(y, padded.data());
+			float* row = ring.data() + size_t((y - base) % kh) * n;
+			std::fill(row, row + n, 0.f);
+			for (int i = 0; i < kw; ++i)
+				axpy(row, padded.data() + i * bpp, kx[i], n);
+		};
+
+		#pragma omp for schedule(dynamic)
+		for (int b = 0; b < nblocks; ++b) {
+			int y0 = b * FILTER_BLOCK, y1 = std::min(y0 + FILTER_BLOCK, h);
+			int base = y0 - ry;		// source row in ring slot 0
+			for (int y = base; y < base + kh - 1; ++y)
+				filter_row(y, base);
+			for (int y = y0; y < y1; ++y) {
+				filter_row(y - ry + kh - 1, base);
+				std::fill(acc.begin(), acc.end(), 0.f);
+				for (int j = 0; j < kh; ++j)
+					axpy(acc.data(), ring.data() + size_t((y - ry + j - base) % kh) * n, ky[j], n);
+				store(y, acc.data());
+			}
+		}
+	}
+}
+
+}	// namespace
+
+TGAImage convolve_separable(const TGAImage &image, const float *kx, int kw, const float *ky, int kh, EdgeMode edge) {
+	int w = image.width(), h = image.height(), bpp = image.bytespp();
+	TGAImage out(w, h, bpp);
+	if (!image.buffer())
+		return out;
+	int rx = kw / 2, ry = kh / 2;
+	separable_passes(w, h, bpp, kx, kw, ky, kh,
+		[&](int y, float* row) { padded_row(image, y, rx, edge, row); },
+		[&](int y, const float* acc) { store_row(image, y, rx, ry, edge, acc, out); });
+	return out;
+}
+
+void convolve_separable(const float *src, float *dst, int w, int h, int nc,
+						const float *kx, int kw, const float *ky, int kh, EdgeMode edge) {
+	int rx = kw / 2, ry = kh / 2;
+	int n = w * nc;
+	auto read = [&](int y, float* row) {
+		int sy = edge_index(y, h, edge);
+		if (sy < 0) {
+			std::fill(row, row + (w + 2 * rx) * nc, 0.f);
+			return;
+		}
+		const float* s = src + size_t(sy) * n;
+		float* d = row + rx * nc;
+		std::copy(s, s + n, d);
+		// the padding
+		auto pad = [&](int x) {
+			int sx = edge_index(x, w, edge);
+			for (int c = 0; c < nc; ++c)
+				d[x * nc + c] = sx < 0 ? 0.f : s[sx * nc + c];
+		};
+		for (int x = -rx; x < 0; ++x)
+			pad(x);
+		for (int x = w; x < w + rx; ++x)
+			pad(x);
+	};
+	auto store = [&](int y, const float* acc) {
+		float* d = dst + size_t(y) * n;
+		std::copy(acc, acc + n, d);
+		if (edge != EDGE_KEEP)
+			return;
+		const float* s = src + size_t(y) * n;
+		if (y < ry || y >= h - ry) {
+			std::copy(s, s + n, d);
+			return;
+		}
+		int k = std::min(rx, w) * nc;
+		std::copy(s, s + k, d);
+		std::copy(s + n - k, s + n, d + n - k);
+	};
+	separable_passes(w, h, nc, kx, kw, ky, kh, read, store);
+}
+
+TGAImage convolve(const TGAImage &image, const float *kernel, int kw, int kh, EdgeMode edge) {
+	std::vector<float> kx, ky;
+	if (separate(kernel, kw, kh, kx, ky))
+		return convolve_separable(image, kx.data(), kw, ky.data(), kh, edge);
+
+	int w = image.width(), h = image.height(), bpp = image.bytespp();
+	TGAImage out(w, h, bpp);
+	if (!image.buffer())
+		return out;
+	int rx = kw / 2, ry = kh / 2;
+	int n = w * bpp, pn = (w + 2 * rx) * bpp;
+	int nblocks = (h + FILTER_BLOCK - 1) / FILTER_BLOCK;
+	auto axpy = row_kernels().axpy;
+
+	#pragma omp parallel
+	{
+		std::vector<float> rows(size_t(FILTER_BLOCK + kh - 1) * pn);	// padded source rows
+		std::vector<float> acc(n);
+
+		#pragma omp for schedule(dynamic)
+		for (int b = 0; b < nblocks; ++b) {
+			int y0 = b * FILTER_BLOCK, y1 = std::min(y0 + FILTER_BLOCK, h);
+			for (int y = y0 - ry; y < y1 - ry + kh - 1; ++y)
+				padded_row(image, y, rx, edge, rows.data() + size_t(y - y0 + ry) * pn);
+			for (int y = y0; y < y1; ++y) {
+				std::fill(acc.begin(), acc.end(), 0.f);
+				for (int j = 0; j < kh; ++j) {
+					const float* row = rows.data() + size_t(y - y0 + j) * pn;
+					for (int i = 0; i < kw; ++i)
+						axpy(acc.data(), row + i * bpp, kernel[j * kw + i], n);
+				}
+				store_row(image, y, rx, ry, edge, acc.data(), out);
+			}
+		}
+	}
+	return out;
+}
+
+namespace {
+
+// weight of every sample of the pixels around a target pixel, tent[(dy + 1) * 3 + dx + 1][i]
+std::vector<std::vector<float>> resolve_weights(int n, ResolveFilter filter) {
+	std::vector<std::vector<float>> wts(9, std::vector<float>(n, 0.f));
+	if (filter == RESOLVE_BOX) {
+		for (int i = 0; i < n; ++i)
+			wts[4][i] = 1.f / n;
+		return wts;
+	}
+	const std::vector<vec2>& ofs = sample_offsets(n);
+	double total = 0;
+	for (int dy = -1; dy <= 1; ++dy) {
+		for (int dx = -1; dx <= 1; ++dx) {
+			for (int i = 0; i < n; ++i) {
+				// sample position relative to the target pixel center, buffers of an
+				// unknown sample count take all of their samples at the pixel center
+				vec2 o = int(ofs.size()) == n ? ofs[i] : vec2(0.5, 0.5);
+				double wx = std::max(0.0, 1 - std::abs(dx + o.x - 0.5));
+				double wy = std::max(0.0, 1 - std::abs(dy + o.y - 0.5));
+				wts[(dy + 1) * 3 + dx + 1][i] = wx * wy;
+				total += wx * wy;
+			}
+		}
+	}
+	for (auto& w : wts)
+		for (float& v : w)
+			v /= total;
+	return wts;
+}
+
+// row y of a sample plane as contiguous colors, TILED buffers are gathered into scratch
+const float* source_row(ColorBuffer& buf, int y, int i, std::vector<color_t>& scratch) {
+	if (buf.layout() == ColorBuffer::LINEAR)
+		return reinterpret_cast<const float*>(buf.row(y, i).begin());
+	for (int x = 0; x < buf.width(); x += BUFFER_TILE)
+		std::memcpy(&scratch[x], buf.address(x, y, i), sizeof(color_t) * std::min(BUFFER_TILE, buf.width() - x));
+	return reinterpret_cast<const float*>(scratch.data());
+}
+
+}	// namespace
+
+void resolve(ColorBuffer &buf, TGAImage &image, ResolveFilter filter) {
+	static_assert(sizeof(color_t) == 4 * sizeof(float), "color_t must be four packed floats");
+	int w = std::min(buf.width(), image.width()), h = std::min(buf.height(), image.height());
+	if (!image.buffer())
+		return;
+	int n = buf.simple_num(), bpp = image.bytespp();
+	int radius = filter == RESOLVE_BOX ? 0 : 1;
+	std::vector<std::vector<float>> wts = resolve_weights(n, filter);
+	for (auto& v : wts)
+		for (float& f : v)
+			f *= 255;	// straight to the byte range
+	const RowKernels& k = row_kernels();
+	buf.flush();	// rows share blocks
+
+	#pragma omp parallel
+	{
+		std::vector<float>   acc(4 * w);
+		std::vector<color_t> scratch(buf.width());
+
+		#pragma omp for schedule(static)
+		for (int y = 0; y < h; ++y) {
+			std::fill(acc.begin(), acc.end(), 0.f);
+			for (int dy = -radius; dy <= radius; ++dy) {
+				int sy = std::clamp(y + dy, 0, buf.height() - 1);
+				for (int i = 0; i < n; ++i) {
+					const float* src = source_row(buf, sy, i, scratch);
+					for (int dx = -radius; dx <= radius; ++dx) {
+						float wt = wts[(dy + 1) * 3 + dx + 1][i];
+						if (wt == 0)
+							continue;
+						// acc[x] += wt * src[x + dx], the pixels that would read outside repeat the edge
+						int x0 = std::max(0, -dx), x1 = std::min(w, buf.width() - dx);
+						k.axpy(acc.data() + 4 * x0, src + 4 * (x0 + dx), wt, 4 * (x1 - x0));
+						for (int x = 0; x < x0; ++x)
+							k.axpy(acc.data() + 4 * x, src + 4 * std::clamp(x + dx, 0, buf.width() - 1), wt, 4);
+						for (int x = x1; x < w; ++x)
+							k.axpy(acc.data() + 4 * x, src + 4 * std::clamp(x + dx, 0, buf.width() - 1), wt, 4);
+					}
+				}
+			}
+			k.pack(image.buffer() + size_t(y) * image.width() * bpp, acc.data(), w, bpp);
+		}
+	}
+}
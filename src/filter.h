@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include "global.h"
+
+class TGAImage;
+template<typename T> class Buffer;
+
+/**
+ * how a filter reads pixels outside the image
+ * 	EDGE_KEEP   : pixels closer to the border than the kernel radius are copied unfiltered
+ * 	EDGE_CLAMP  : the nearest border pixel
+ * 	EDGE_WRAP   : the image repeats
+ * 	EDGE_MIRROR : the image is reflected at the border, the border pixel repeated
+ * 	EDGE_ZERO   : transparent black
+ */
+enum EdgeMode { EDGE_KEEP, EDGE_CLAMP, EDGE_WRAP, EDGE_MIRROR, EDGE_ZERO };
+
+/**
+ * @brief convolve every channel of an image with a kw x kh kernel
+ * 
+ * @param kernel kh rows of kw weights, kernel[j * kw + i] weights the pixel (x + i - kw / 2, y + j - kh / 2)
+ * a kernel that is the outer product of a column and a row, like a box or a gaussian, 
+ * is detected and runs as a horizontal and a vertical pass.
+ * rows are filtered in parallel, results are rounded and clamped to [0, 255].
+ */
+TGAImage convolve(const TGAImage& image, const float* kernel, int kw, int kh, EdgeMode edge = EDGE_KEEP);
+
+// same with the kernel given as its horizontal and vertical factors
+TGAImage convolve_separable(const TGAImage& image, const float* kx, int kw, const float* ky, int kh, 
+							EdgeMode edge = EDGE_KEEP);
+
+/**
+ * @brief convolve_separable on a plane of w x h pixels of nc floats, e.g. the moments of a
+ * shadow map. the results are stored as they are, without rounding or clamping.
+ * dst must not overlap src.
+ */
+void convolve_separable(const float* src, float* dst, int w, int h, int nc,
+						const float* kx, int kw, const float* ky, int kh, EdgeMode edge = EDGE_KEEP);
+
+/**
+ * reconstruction filter of a multisample resolve
+ * 	RESOLVE_BOX  : the average of the pixel's own samples
+ * 	RESOLVE_TENT : samples within one pixel of the center, weighted by distance per axis
+ */
+enum ResolveFilter { RESOLVE_BOX, RESOLVE_TENT };
+
+/**
+ * @brief resolve the samples of a color buffer into the pixels of an image
+ * 
+ * rows are resolved in parallel, the edge pixels of the buffer repeat for the tent filter.
+ * only the area both have in common is written.
+ */
+void resolve(Buffer<color_t>& buf, TGAImage& image, ResolveFilter filter = RESOLVE_BOX);
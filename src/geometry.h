@@ -2,298 +2,311 @@
 #include <cmath>
 #include <cassert>
 #include <iostream>
-
-template<int n> class vec
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
+
+/**
+ * vec<n, T> and mat<nrows, ncols, T> hold scalars of type T, double by default.
+ * the float versions vec2f/vec3f/vec4f/mat3f/mat4f are half the size, vec4f is
+ * 16 byte aligned so a row of mat4f is one SSE register, and mat4f * vec4f, dot,
+ * cross and normalize of vec3f/vec4f have SSE overloads at the end of the file.
+ */
+
+// T in a position where it isn't deduced, so vec<n, float> * 0.5 picks T = float
+template<typename T> struct scalar_of { using type = T; };
+template<typename T> using scalar_t = typename scalar_of<T>::type;
+
+template<int n, typename T = double> class vec
 {
 public:
 	vec() = default;
-	double & operator[](const int i) 	   { assert(i >= 0 && i < n); return data[i]; }
-	double   operator[](const int i) const { assert(i >= 0 && i < n); return data[i]; }
-	double 	 norm2() const { return *this * *this; }
-	double 	 norm()  const { return std::sqrt(norm2()); }
+	template<typename U> explicit vec(const vec<n, U>& v) { for (int i = n; i--; data[i] = v[i]); }
+	T & operator[](const int i) 	  { assert(i >= 0 && i < n); return data[i]; }
+	T   operator[](const int i) const { assert(i >= 0 && i < n); return data[i]; }
+	T 	norm2() const { return dot(*this, *this); }
+	T 	norm()  const { return std::sqrt(norm2()); }
 private:
-	double data[n] = {0};
+	T data[n] = {0};
 };
 
-template<int n> vec<n> operator*(const vec<n>& lhs, const vec<n>& rhs) {
-	vec<n> ret;
+template<int n, typename T> vec<n, T> operator*(const vec<n, T>& lhs, const vec<n, T>& rhs) {
+	vec<n, T> ret;
 	for (int i = n; i--; ret[i] = lhs[i] * rhs[i]);
 	return ret;
 }
 
-template<int n> vec<n> operator*(const vec<n>& lhs, const double& rhs) {
-	vec<n> ret = lhs;
+template<int n, typename T> vec<n, T> operator*(const vec<n, T>& lhs, const scalar_t<T>& rhs) {
+	vec<n, T> ret = lhs;
 	for (int i = n; i--; ret[i] *= rhs);
 	return ret;
 }
 
-template<int n> vec<n> operator*(const double& lhs, const vec<n>& rhs) {
-	vec<n> ret = rhs;
+template<int n, typename T> vec<n, T> operator*(const scalar_t<T>& lhs, const vec<n, T>& rhs) {
+	vec<n, T> ret = rhs;
 	for (int i = n; i--; ret[i] *= lhs);
 	return ret;
 }
 
-template<int n> vec<n> operator/(const vec<n>& lhs, const double rhs) {
-	vec<n> ret = lhs;
+template<int n, typename T> vec<n, T> operator/(const vec<n, T>& lhs, const scalar_t<T> rhs) {
+	vec<n, T> ret = lhs;
 	for (int i = n; i--; ret[i] /= rhs);
 	return ret;
 }
 
-template<int n> vec<n> operator+(const vec<n>& lhs, const vec<n>& rhs) {
-	vec<n> ret = lhs;
+template<int n, typename T> vec<n, T> operator+(const vec<n, T>& lhs, const vec<n, T>& rhs) {
+	vec<n, T> ret = lhs;
 	for (int i = n; i--; ret[i] += rhs[i]);
 	return ret;
 }
 
-template<int n> vec<n> operator+(const vec<n>& lhs, const double& rhs) {
-	vec<n> ret = lhs;
+template<int n, typename T> vec<n, T> operator+(const vec<n, T>& lhs, const scalar_t<T>& rhs) {
+	vec<n, T> ret = lhs;
 	for (int i = n; i--; ret[i] += rhs);
 	return ret;
 }
 
-template<int n> vec<n> operator+(const double& lhs, const vec<n>& rhs) {
-	vec<n> ret = rhs;
+template<int n, typename T> vec<n, T> operator+(const scalar_t<T>& lhs, const vec<n, T>& rhs) {
+	vec<n, T> ret = rhs;
 	for (int i = n; i--; ret[i] += lhs);
 	return ret;
 }
 
-template<int n> vec<n> operator-(const vec<n>& lhs, const vec<n>& rhs) {
-	vec<n> ret = lhs;
+template<int n, typename T> vec<n, T> operator-(const vec<n, T>& lhs, const vec<n, T>& rhs) {
+	vec<n, T> ret = lhs;
 	for (int i = n; i--; ret[i] -= rhs[i]);
 	return ret;
 }
 
-template<int n> std::ostream& operator<<(std::ostream& out, const vec<n> rhs) {
+template<int n, typename T> std::ostream& operator<<(std::ostream& out, const vec<n, T> rhs) {
 	for (int i = 0; i < n; ++i)
 		out << rhs[i] << ' ';
 	return out;
 }
 
-template<int n1, int n2> vec<n1> embed(const vec<n2> v, double fill = 1) {
-	vec<n1> ret;
+template<int n1, int n2, typename T> vec<n1, T> embed(const vec<n2, T> v, scalar_t<T> fill = 1) {
+	vec<n1, T> ret;
 	for (int i = n1; i--; ret[i] = (i < n2) ? v[i] : fill);
 	return ret;
 }
 
-template<int n1, int n2> vec<n1> proj(const vec<n2> v) {
-	vec<n1> ret;
+template<int n1, int n2, typename T> vec<n1, T> proj(const vec<n2, T> v) {
+	vec<n1, T> ret;
 	for (int i = n1; i--; ret[i] = v[i]);
 	return ret;
 }
 
-template<> class vec<2>
+template<int n, typename T> T dot(const vec<n, T>& v1, const vec<n, T>& v2) {
+	T ret = 0;
+	for (int i = n; i--; ret += v1[i] * v2[i]);
+	return ret;
+}
+
+// v / |v|, a free function so the float versions can overload it
+template<int n, typename T> vec<n, T> normalized(const vec<n, T>& v) { return v / v.norm(); }
+
+template<typename T> class vec<2, T>
 {
 public:
-	double x, y;
+	T x, y;
 	vec() = default;
-	vec(double x, double y): x(x), y(y) {}
-	double & operator[](const int i)	   { assert(i == 0 || i == 1); return i == 0 ? x : y;}
-	double 	 operator[](const int i) const { assert(i == 0 || i == 1); return i == 0 ? x : y;}
-	vec   operator-() { return vec(-x, -y); }
-	vec&  operator=(const vec& v) {
-		x = v.x;
-		y = v.y;
-		return *this;
-	}
-	double norm2() const { return x * x + y * y; }
-	double norm()  const { return std::sqrt(norm2()); }
-	vec normalize() const { return *this / norm();}
+	vec(T x, T y): x(x), y(y) {}
+	template<typename U> explicit vec(const vec<2, U>& v): x(v.x), y(v.y) {}
+	T & operator[](const int i)		  { assert(i == 0 || i == 1); return this->*members[i]; }
+	T 	operator[](const int i) const { assert(i == 0 || i == 1); return this->*members[i]; }
+	vec operator-() const { return vec(-x, -y); }
+	T 	norm2() const { return x * x + y * y; }
+	T 	norm()  const { return std::sqrt(norm2()); }
+	vec normalize() const { return normalized(*this); }
+private:
+	static constexpr T vec::* members[2] = {&vec::x, &vec::y};
 };
 
-template<> class vec<3>
+template<typename T> class vec<3, T>
 {
 public:
-	double x, y, z;
+	T x, y, z;
 	vec() = default;
-	vec(double x, double y, double z): x(x), y(y), z(z) {}
-	vec(const vec<4>& v);
-	double & operator[](const int i) 	   { assert(i >= 0 && i < 3); return i ? (1 == i ? y : z) : x;}
-	double 	 operator[](const int i) const { assert(i >= 0 && i < 3); return i ? (1 == i ? y : z) : x;}
-	vec   operator-() { return vec(-x, -y, -z); }
-	vec&  operator=(const vec& v) {
-		x = v.x;
-		y = v.y;
-		z = v.z;
-		return *this;
-	}
-	double norm2() const { return x * x + y * y + z * z; }
-	double norm()  const { return std::sqrt(norm2()); }
-	vec normalize() const { return *this / norm();}
+	vec(T x, T y, T z): x(x), y(y), z(z) {}
+	vec(const vec<4, T>& v);
+	template<typename U> explicit vec(const vec<3, U>& v): x(v.x), y(v.y), z(v.z) {}
+	T & operator[](const int i) 	  { assert(i >= 0 && i < 3); return this->*members[i]; }
+	T 	operator[](const int i) const { assert(i >= 0 && i < 3); return this->*members[i]; }
+	vec operator-() const { return vec(-x, -y, -z); }
+	T 	norm2() const { return x * x + y * y + z * z; }
+	T 	norm()  const { return std::sqrt(norm2()); }
+	vec normalize() const { return normalized(*this); }
+private:
+	static constexpr T vec::* members[3] = {&vec::x, &vec::y, &vec::z};
 };
 
-template<> class vec<4>
+// four floats fill an SSE register, so vec4f gets its alignment
+template<typename T> class alignas(sizeof(T) == 4 ? 16 : alignof(T)) vec<4, T>
 {
 public:
-	double x, y, z, w;
+	T x, y, z, w;
 	vec() = default;
-	vec(double x, double y, double z, double w): x(x), y(y), z(z), w(w) {}
-	vec(const vec<3> &v, double w_): x(v.x), y(v.y), z(v.z), w(w_) {}
-	double & operator[](const int i) {
-		 assert(i >= 0 && i < 4);  
-		 if (i == 0)	return x;
-		 else if (i == 1)	return y;
-		 else if (i == 2)	return z;
-		 else	return w;
-	 }
-	double 	 operator[](const int i) const { 
-		assert(i >= 0 && i < 4); 
-		 if (i == 0)	return x;
-		 else if (i == 1)	return y;
-		 else if (i == 2)	return z;
-		 else	return w;
-	}
-	vec   operator-() { return vec(-x, -y, -z, -w); }
-	vec&  operator=(const vec& v) {
-		x = v.x;
-		y = v.y;
-		z = v.z;
-		w = v.w;
-		return *this;
-	}
-	double norm2() const { return x*x + y*y + z*z + w*w; }
-	double norm()  const { return std::sqrt(norm2()); }
-	vec normalize() const { return *this / norm(); }
+	vec(T x, T y, T z, T w): x(x), y(y), z(z), w(w) {}
+	vec(const vec<3, T> &v, T w_): x(v.x), y(v.y), z(v.z), w(w_) {}
+	template<typename U> explicit vec(const vec<4, U>& v): x(v.x), y(v.y), z(v.z), w(v.w) {}
+	T & operator[](const int i) 	  { assert(i >= 0 && i < 4); return this->*members[i]; }
+	T 	operator[](const int i) const { assert(i >= 0 && i < 4); return this->*members[i]; }
+	vec operator-() const { return vec(-x, -y, -z, -w); }
+	T 	norm2() const { return x*x + y*y + z*z + w*w; }
+	T 	norm()  const { return std::sqrt(norm2()); }
+	vec normalize() const { return normalized(*this); }
+private:
+	static constexpr T vec::* members[4] = {&vec::x, &vec::y, &vec::z, &vec::w};
 };
 
 using vec2 = vec<2>;
 using vec3 = vec<3>;
 using vec4 = vec<4>;
-
-double dot(const vec2& v1, const vec2& v2);
-double dot(const vec3& v1, const vec3& v2);
-double dot(const vec4& v1, const vec4& v2);
-vec3 cross(const vec3& v1, const vec3& v2);
+using vec2f = vec<2, float>;
+using vec3f = vec<3, float>;
+using vec4f = vec<4, float>;
+
+template<typename T> T dot(const vec<2, T>& v1, const vec<2, T>& v2) { return v1.x * v2.x + v1.y * v2.y; }
+template<typename T> T dot(const vec<3, T>& v1, const vec<3, T>& v2) { return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z; }
+template<typename T> T dot(const vec<4, T>& v1, const vec<4, T>& v2) {
+	return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z + v1.w * v2.w;
+}
+template<typename T> vec<3, T> cross(const vec<3, T>& v1, const vec<3, T>& v2) {
+	return vec<3, T>{v1.y*v2.z-v1.z*v2.y, v1.z*v2.x-v1.x*v2.z, v1.x*v2.y-v1.y*v2.x};
+}
 
 
-template<int n> struct dt;
+template<int n, typename T> struct dt;
+template<int n, typename T> struct inv;
 
-template<int nrows, int ncols> class mat
+template<int nrows, int ncols, typename T = double> class mat
 {
 public:
-		  vec<ncols> & operator[](const int i)       { assert(i >= 0 && i < nrows); return rows[i]; }
-	const vec<ncols> & operator[](const int i) const { assert(i >= 0 && i < nrows); return rows[i]; }
-	vec<nrows> col(const int idx) const {
+	mat() = default;
+	template<typename U> explicit mat(const mat<nrows, ncols, U>& m) { for (int i = nrows; i--; rows[i] = vec<ncols, T>(m[i])); }
+		  vec<ncols, T> & operator[](const int i)       { assert(i >= 0 && i < nrows); return rows[i]; }
+	const vec<ncols, T> & operator[](const int i) const { assert(i >= 0 && i < nrows); return rows[i]; }
+	vec<nrows, T> col(const int idx) const {
 		assert(idx >= 0 && idx < ncols);
-		vec<nrows> ret;
+		vec<nrows, T> ret;
 		for (int i = nrows; i--; ret[i] = rows[i][idx]);
 		return ret;
 	}
-	void set_col(const int idx, vec<nrows> v) {
+	void set_col(const int idx, vec<nrows, T> v) {
 		assert(idx >= 0 && idx < ncols);
 		for (int i = nrows; i--; rows[i][idx] = v[i]);
 	}
 
 	/**
 	 * @brief return a identity matrix
-	 * 
-	 * @return mat<nrows, ncols> 
+	 *
+	 * @return mat<nrows, ncols, T>
 	 */
-	static mat<nrows, ncols> identity() {
-		mat<nrows, ncols> ret;
+	static mat<nrows, ncols, T> identity() {
+		mat<nrows, ncols, T> ret;
 		for (int i = nrows; i--; )
 			for (int j = ncols; j--; ret[i][j] = (i == j));
 		return ret;
 	}
 
-	double det() const {
-		return dt<ncols>::det(*this);
+	T det() const {
+		return dt<ncols, T>::det(*this);
 	}
 
-	mat<nrows-1, ncols-1> get_minor(const int row, const int col) const {
-		mat<nrows-1, ncols-1> ret;
+	mat<nrows-1, ncols-1, T> get_minor(const int row, const int col) const {
+		mat<nrows-1, ncols-1, T> ret;
 		for (int i = nrows - 1; i--; )
 			for (int j = ncols - 1; j--; ret[i][j] = rows[i<row?i:(i+1)][j<col?j:(j+1)]);
 		return ret;
 	}
 
 	// 代数余子式
-	double cofactor(const int row, const int col) const {
+	T cofactor(const int row, const int col) const {
 		return get_minor(row, col).det() * ((row + col) % 2 ? -1 : 1);
 	}
 
 	// 伴随矩阵的转置
 	// adj(A^T)_{ij} = C_{ji};
-	mat<nrows, ncols> adjugate() const {
-		mat<nrows, ncols> ret;
+	mat<nrows, ncols, T> adjugate() const {
+		mat<nrows, ncols, T> ret;
 		for (int i = nrows; i--;)
 			for (int j = ncols; j--; ret[i][j] = cofactor(i, j));
-		return ret;		
+		return ret;
 	}
 
-	mat<ncols, nrows> invert_transpose() const {
-		mat<ncols, nrows> ret = adjugate();
-		return ret / (dot(ret[0], rows[0])); 	// dot(ret[0], rows[0]) == det(A)
+	mat<ncols, nrows, T> invert_transpose() const {
+		return inv<nrows, T>::invert_transpose(*this);
 	}
 
 	// 逆矩阵
-	mat<nrows, ncols> invert() const {
+	mat<nrows, ncols, T> invert() const {
 		return invert_transpose().transpose();
 	}
 
 	// 转置矩阵
-	mat<ncols, nrows> transpose() const {
-		mat<ncols, nrows> ret;
+	mat<ncols, nrows, T> transpose() const {
+		mat<ncols, nrows, T> ret;
 		for (int i = ncols; i--; ret[i] = this->col(i));
 		return ret;
 	}
 
 private:
-	vec<ncols> rows[nrows] = {{}};
+	vec<ncols, T> rows[nrows] = {{}};
 };
 
-template<int R1, int C1, int C2> 
-mat<R1,C2> operator*(const mat<R1, C1>& lhs, const mat<C1, C2>& rhs) {
-	mat<R1, C2> ret;
+template<int R1, int C1, int C2, typename T>
+mat<R1, C2, T> operator*(const mat<R1, C1, T>& lhs, const mat<C1, C2, T>& rhs) {
+	mat<R1, C2, T> ret;
 	for (int i = R1; i--;)
 		for (int j = C2; j--; ret[i][j] = dot(lhs[i], rhs.col(j)));
 	return ret;
 }
 
-template<int nrows, int ncols>
-vec<nrows> operator*(const mat<nrows, ncols>& lhs, const vec<ncols>& rhs) {
-	vec<nrows> ret;
+template<int nrows, int ncols, typename T>
+vec<nrows, T> operator*(const mat<nrows, ncols, T>& lhs, const vec<ncols, T>& rhs) {
+	vec<nrows, T> ret;
 	for (int i = nrows; i--; ret[i] = dot(lhs[i], rhs));
 	return ret;
 }
 
-template<int nrows, int ncols>
-mat<nrows, ncols> operator*(const mat<nrows, ncols>& lhs, const double& val) {
-	mat<nrows, ncols> ret;
+template<int nrows, int ncols, typename T>
+mat<nrows, ncols, T> operator*(const mat<nrows, ncols, T>& lhs, const scalar_t<T>& val) {
+	mat<nrows, ncols, T> ret;
 	for (int i = nrows; i--; ret[i] = lhs[i] * val);
 	return ret;
 }
 
-template<int nrows, int ncols>
-mat<nrows, ncols> operator*(const double& val,  const mat<nrows, ncols>& rhs) {
-	mat<nrows, ncols> ret;
+template<int nrows, int ncols, typename T>
+mat<nrows, ncols, T> operator*(const scalar_t<T>& val,  const mat<nrows, ncols, T>& rhs) {
+	mat<nrows, ncols, T> ret;
 	for (int i = nrows; i--; ret[i] = rhs[i] * val);
 	return ret;
 }
 
 
-template<int nrows, int ncols>
-mat<nrows, ncols> operator/(const mat<nrows, ncols>& lhs, const double& val) {
-	mat<nrows, ncols> ret;
+template<int nrows, int ncols, typename T>
+mat<nrows, ncols, T> operator/(const mat<nrows, ncols, T>& lhs, const scalar_t<T>& val) {
+	mat<nrows, ncols, T> ret;
 	for (int i = nrows; i--; ret[i] = lhs[i] / val);
 	return ret;
 }
 
-template<int nrows, int ncols>
-mat<nrows, ncols> operator+(const mat<nrows, ncols>& lhs, const mat<nrows, ncols>& rhs) {
-	mat<nrows, ncols> ret;
+template<int nrows, int ncols, typename T>
+mat<nrows, ncols, T> operator+(const mat<nrows, ncols, T>& lhs, const mat<nrows, ncols, T>& rhs) {
+	mat<nrows, ncols, T> ret;
 	for (int i = nrows; i--; ret[i] = lhs[i] + rhs[i]);
 	return ret;
 }
 
-template<int nrows, int ncols>
-mat<nrows, ncols> operator-(const mat<nrows, ncols>& lhs, const mat<nrows, ncols>& rhs) {
-	mat<nrows, ncols> ret;
+template<int nrows, int ncols, typename T>
+mat<nrows, ncols, T> operator-(const mat<nrows, ncols, T>& lhs, const mat<nrows, ncols, T>& rhs) {
+	mat<nrows, ncols, T> ret;
 	for (int i = nrows; i--; ret[i] = lhs[i] - rhs[i]);
 	return ret;
 }
 
-template<int nrows, int ncols>
-std::ostream& operator<<(std::ostream& out, const mat<nrows, ncols>& m) {
+template<int nrows, int ncols, typename T>
+std::ostream& operator<<(std::ostream& out, const mat<nrows, ncols, T>& m) {
 	for (int i = 0; i < nrows; ++i)
 		out << m[i] << "\n";
 	return out;
@@ -301,21 +314,139 @@ std::ostream& operator<<(std::ostream& out, const mat<nrows, ncols>& m) {
 
 using mat4 = mat<4, 4>;
 using mat3 = mat<3, 3>;
+using mat4f = mat<4, 4, float>;
+using mat3f = mat<3, 3, float>;
 
-template<int n> struct dt 
+template<int n, typename T> struct dt
 {
-	static double det(const mat<n, n>& m) {
-		double ret = 0;
+	static T det(const mat<n, n, T>& m) {
+		T ret = 0;
 		for (int i = n; i--; ret += (m[0][i] * m.cofactor(0, i)) );
 		return ret;
 	}
 };
 
-template<> struct dt<1>
+template<typename T> struct dt<1, T>
 {
-	static double det(const mat<1,1>& m) {
+	static T det(const mat<1, 1, T>& m) {
 		return m[0][0];
 	}
 };
 
-inline vec<3>::vec(const vec<4> &v): x(v.x), y(v.y), z(v.z) {}
+template<typename T> struct dt<3, T>
+{
+	static T det(const mat<3, 3, T>& m) {
+		return dot(m[0], cross(m[1], m[2]));
+	}
+};
+
+// the inverse transposed, by cofactors for any size and in closed form for 3x3 and 4x4
+template<int n, typename T> struct inv
+{
+	static mat<n, n, T> invert_transpose(const mat<n, n, T>& m) {
+		mat<n, n, T> ret = m.adjugate();
+		return ret / (dot(ret[0], m[0])); 	// dot(ret[0], m[0]) == det(A)
+	}
+};
+
+template<typename T> struct inv<3, T>
+{
+	static mat<3, 3, T> invert_transpose(const mat<3, 3, T>& m) {
+		// the rows of the cofactor matrix are cross products of the other two rows
+		mat<3, 3, T> ret;
+		ret[0] = cross(m[1], m[2]);
+		ret[1] = cross(m[2], m[0]);
+		ret[2] = cross(m[0], m[1]);
+		return ret / dot(ret[0], m[0]);
+	}
+};
+
+template<typename T> struct inv<4, T>
+{
+	static mat<4, 4, T> invert_transpose(const mat<4, 4, T>& m) {
+		// 2x2 determinants of the upper two rows (s) and the lower two rows (c)
+		const vec<4, T> &a = m[0], &b = m[1], &c = m[2], &d = m[3];
+		T s0 = a.x * b.y - b.x * a.y, s1 = a.x * b.z - b.x * a.z, s2 = a.x * b.w - b.x * a.w;
+		T s3 = a.y * b.z - b.y * a.z, s4 = a.y * b.w - b.y * a.w, s5 = a.z * b.w - b.z * a.w;
+		T c0 = c.x * d.y - d.x * c.y, c1 = c.x * d.z - d.x * c.z, c2 = c.x * d.w - d.x * c.w;
+		T c3 = c.y * d.z - d.y * c.z, c4 = c.y * d.w - d.y * c.w, c5 = c.z * d.w - d.z * c.w;
+		T r = 1 / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+
+		mat<4, 4, T> ret;
+		ret[0] = vec<4, T>( b.y * c5 - b.z * c4 + b.w * c3, -b.x * c5 + b.z * c2 - b.w * c1,
+						    b.x * c4 - b.y * c2 + b.w * c0, -b.x * c3 + b.y * c1 - b.z * c0) * r;
+		ret[1] = vec<4, T>(-a.y * c5 + a.z * c4 - a.w * c3,  a.x * c5 - a.z * c2 + a.w * c1,
+						   -a.x * c4 + a.y * c2 - a.w * c0,  a.x * c3 - a.y * c1 + a.z * c0) * r;
+		ret[2] = vec<4, T>( d.y * s5 - d.z * s4 + d.w * s3, -d.x * s5 + d.z * s2 - d.w * s1,
+						    d.x * s4 - d.y * s2 + d.w * s0, -d.x * s3 + d.y * s1 - d.z * s0) * r;
+		ret[3] = vec<4, T>(-c.y * s5 + c.z * s4 - c.w * s3,  c.x * s5 - c.z * s2 + c.w * s1,
+						   -c.x * s4 + c.y * s2 - c.w * s0,  c.x * s3 - c.y * s1 + c.z * s0) * r;
+		return ret;
+	}
+};
+
+template<typename T> inline vec<3, T>::vec(const vec<4, T> &v): x(v.x), y(v.y), z(v.z) {}
+
+#if defined(__SSE2__)
+// SSE versions of the float math, they win overload resolution over the templates
+
+inline __m128 sse_load(const vec4f& v) { return _mm_load_ps(&v.x); }
+inline __m128 sse_load(const vec3f& v) { return _mm_setr_ps(v.x, v.y, v.z, 0.f); }
+inline vec4f  sse_store4(__m128 r) { vec4f v; _mm_store_ps(&v.x, r); return v; }
+inline vec3f  sse_store3(__m128 r) {
+	alignas(16) float f[4];
+	_mm_store_ps(f, r);
+	return vec3f(f[0], f[1], f[2]);
+}
+// the sum of the four lanes in every lane
+inline __m128 sse_hsum(__m128 r) {
+	r = _mm_add_ps(r, _mm_shuffle_ps(r, r, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_add_ps(r, _mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+inline float dot(const vec4f& v1, const vec4f& v2) { return _mm_cvtss_f32(sse_hsum(_mm_mul_ps(sse_load(v1), sse_load(v2)))); }
+inline float dot(const vec3f& v1, const vec3f& v2) { return _mm_cvtss_f32(sse_hsum(_mm_mul_ps(sse_load(v1), sse_load(v2)))); }
+
+inline vec3f cross(const vec3f& v1, const vec3f& v2) {
+	__m128 a = sse_load(v1), b = sse_load(v2);
+	// a * b.yzx - a.yzx * b, then rotate back to xyz
+	__m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+	return sse_store3(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+
+inline vec4f normalized(const vec4f& v) {
+	__m128 r = sse_load(v);
+	return sse_store4(_mm_div_ps(r, _mm_sqrt_ps(sse_hsum(_mm_mul_ps(r, r)))));
+}
+
+inline vec3f normalized(const vec3f& v) {
+	__m128 r = sse_load(v);
+	return sse_store3(_mm_div_ps(r, _mm_sqrt_ps(sse_hsum(_mm_mul_ps(r, r)))));
+}
+
+inline vec4f operator*(const mat4f& m, const vec4f& v) {
+	__m128 r = sse_load(v);
+	__m128 p0 = _mm_mul_ps(sse_load(m[0]), r);
+	__m128 p1 = _mm_mul_ps(sse_load(m[1]), r);
+	__m128 p2 = _mm_mul_ps(sse_load(m[2]), r);
+	__m128 p3 = _mm_mul_ps(sse_load(m[3]), r);
+	// lane i of the sum is the dot product of row i
+	_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+	return sse_store4(_mm_add_ps(_mm_add_ps(p0, p1), _mm_add_ps(p2, p3)));
+}
+
+inline mat4f operator*(const mat4f& lhs, const mat4f& rhs) {
+	// row i of the product is lhs[i][0] * rhs[0] + ... + lhs[i][3] * rhs[3]
+	mat4f ret;
+	__m128 r0 = sse_load(rhs[0]), r1 = sse_load(rhs[1]), r2 = sse_load(rhs[2]), r3 = sse_load(rhs[3]);
+	for (int i = 0; i < 4; ++i) {
+		const vec4f& l = lhs[i];
+		__m128 s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(l.x), r0), _mm_mul_ps(_mm_set1_ps(l.y), r1));
+		__m128 t = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(l.z), r2), _mm_mul_ps(_mm_set1_ps(l.w), r3));
+		ret[i] = sse_store4(_mm_add_ps(s, t));
+	}
+	return ret;
+}
+#endif
@@ -1,5 +1,7 @@
 #pragma once
+#include <memory>
 #include <optional>
+#include <type_traits>
 #include "tgaimage.h"
 #include "buffer.h"
 
@@ -8,9 +10,76 @@ class IShader {
 public:
 	virtual vec4 vertex(int iface, int nthvert) = 0;
 	virtual std::optional<color_t> fragment(vec3 bar) = 0;
+	// copy of the shader for a raster thread, varyings live in the shader so 
+	// every thread needs its own. return nullptr to raster on the calling thread
+	virtual std::unique_ptr<IShader> clone() const { return nullptr; }
+	// varyings of one vertex as nvaryings() doubles, so the pipeline can run vertex()
+	// once per vertex and restore the result for every face using it.
+	// -1 if not supported, vertex() is then run again for every face.
+	// only valid if vertex() depends on the model's v/vt/vn of the corner, not on iface
+	virtual int  nvaryings() const { return -1; }
+	// copy the varyings vertex() wrote for vertex nthvert out of the shader / back into it
+	virtual void save_varyings(int /*nthvert*/, double* /*out*/) const {}
+	virtual void load_varyings(int /*nthvert*/, const double* /*in*/) {}
 	virtual ~IShader() = default;
+
+	// change of the perspective-correct bar to the next pixel in x and in y, set by the
+	// rasterizer before every fragment(). varying * bar_ddx is the screen derivative
+	// of a varying, e.g. the uv footprint for Texture::sample. it is evaluated at the
+	// neighbor pixels, where a gpu would difference the 2x2 quad of the fragment
+	vec3 bar_ddx{};
+	vec3 bar_ddy{};
+	// by default depth is tested and written before fragment(), which only runs for pixels
+	// with a sample in front. a shader that discards, like an alpha test, sets late_z so
+	// the depth of a sample is only written once fragment() kept it
+	bool late_z = false;
 };
 
+// helpers for the varyings interface of IShader, a varying is either
+// a mat<n, 3, T> with a column per vertex or a vec<3, T> with an element per vertex
+template<int n, typename T> inline int  varying_size(const mat<n, 3, T>&) { return n; }
+template<typename T> inline int varying_size(const vec<3, T>&) { return 1; }
+template<int n, typename T> inline void pack_varying(double*& out, int nthvert, const mat<n, 3, T>& m) {
+	for (int i = 0; i < n; ++i)
+		*out++ = m[i][nthvert];
+}
+template<typename T> inline void pack_varying(double*& out, int nthvert, const vec<3, T>& v) { *out++ = v[nthvert]; }
+template<int n, typename T> inline void unpack_varying(const double*& in, int nthvert, mat<n, 3, T>& m) {
+	for (int i = 0; i < n; ++i)
+		m[i][nthvert] = *in++;
+}
+template<typename T> inline void unpack_varying(const double*& in, int nthvert, vec<3, T>& v) { v[nthvert] = *in++; }
+
+template<typename... V> inline int count_varyings(const V&... v) { return (varying_size(v) + ... + 0); }
+template<typename... V> inline void pack_varyings(double* out, int nthvert, const V&... v) {
+	(pack_varying(out, nthvert, v), ...);
+}
+template<typename... V> inline void unpack_varyings(const double* in, int nthvert, V&... v) {
+	(unpack_varying(in, nthvert, v), ...);
+}
+
+// a varying at bar, in double for the fragment math. varyings may be float, so the
+// vertex stage can write them straight from the float mesh arrays
+template<int n, typename T> inline vec<n> interpolate(const mat<n, 3, T>& v, const vec3& bar) {
+	return vec<n>(v * vec<3, T>(bar));
+}
+
+// call the shader stages of a known shader type without the virtual dispatch,
+// so the compiler can inline them into the raster loops
+template<typename ShaderT> inline vec4 shader_vertex(ShaderT& shader, int iface, int nthvert) {
+	if constexpr (std::is_same_v<ShaderT, IShader>)
+		return shader.vertex(iface, nthvert);
+	else
+		return shader.ShaderT::vertex(iface, nthvert);
+}
+
+template<typename ShaderT> inline std::optional<color_t> shader_fragment(ShaderT& shader, vec3 bar) {
+	if constexpr (std::is_same_v<ShaderT, IShader>)
+		return shader.fragment(bar);
+	else
+		return shader.ShaderT::fragment(bar);
+}
+
 
 mat4 translate(const mat4& m, const vec3& v);
 
@@ -8,4 +8,36 @@ using depth_t = float;
 
 
 // global variable
-const uint32_t GL_BLEND = 0x01;	// alpha blend
\ No newline at end of file
+const uint32_t GL_BLEND = 0x01;	// alpha blend
+
+// faces culled by winding, front faces are counter-clockwise on screen
+enum CullMode { CULL_NONE, CULL_FRONT, CULL_BACK };
+
+// depth test of a sample against the depth buffer, greater depth is nearer
+enum DepthFunc { DEPTH_ALWAYS, DEPTH_LESS, DEPTH_LEQUAL, DEPTH_EQUAL, DEPTH_GEQUAL, DEPTH_GREATER };
+
+// channels written to the color buffer
+const uint32_t COLOR_R    = 0x01;
+const uint32_t COLOR_G    = 0x02;
+const uint32_t COLOR_B    = 0x04;
+const uint32_t COLOR_A    = 0x08;
+const uint32_t COLOR_RGBA = COLOR_R | COLOR_G | COLOR_B | COLOR_A;
+
+/**
+ * fixed function state of a draw
+ * 	depth_func  : a sample is drawn if func(its depth, the buffer's depth)
+ * 	depth_write : passing samples overwrite the depth buffer
+ * 	color_mask  : COLOR_* channels written, none runs no fragment shader at all
+ * 	cull        : faces culled by winding
+ * 	blend       : color is src * src.a + dst * (1 - src.a)
+ * 	prepass     : draw the depth first without shading, then shade the samples
+ * 				  whose depth is equal, so every visible sample is shaded once
+ */
+struct RenderState {
+	DepthFunc depth_func  = DEPTH_GREATER;
+	bool      depth_write = true;
+	uint32_t  color_mask  = COLOR_RGBA;
+	CullMode  cull        = CULL_NONE;
+	bool      blend       = false;
+	bool      prepass     = false;
+};
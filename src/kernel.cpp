@@ -0,0 +1,93 @@
+#include "kernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNEL_AVX2
+#include <immintrin.h>
+#endif
+
+static bool depth_test(DepthFunc func, float d, float z) {
+	switch (func) {
+		case DEPTH_LESS:    return d <  z;
+		case DEPTH_LEQUAL:  return d <= z;
+		case DEPTH_EQUAL:   return d == z;
+		case DEPTH_GEQUAL:  return d >= z;
+		case DEPTH_GREATER: return d >  z;
+		default:            return true;
+	}
+}
+
+uint32_t depth_span_scalar(const DepthSpan &span, float *zrow, uint32_t &passed) {
+	uint32_t covered = 0;
+	passed = 0;
+	for (int i = 0; i < KERNEL_WIDTH; ++i) {
+		if (!(span.lanes >> i & 1))
+			continue;
+		int64_t e0 = span.e[0] + span.step[0] * i;
+		int64_t e1 = span.e[1] + span.step[1] * i;
+		int64_t e2 = span.e[2] + span.step[2] * i;
+		if ((e0 | e1 | e2) < 0)
+			continue;
+		covered |= 1u << i;
+		float d = span.z + span.dzdx * (span.fx + i);
+		if (d >= -1.f && d <= 1.f && depth_test(span.func, d, zrow[i])) {
+			if (span.write)
+				zrow[i] = d;
+			passed |= 1u << i;
+		}
+	}
+	return covered;
+}
+
+#ifdef KERNEL_AVX2
+__attribute__((target("avx2")))
+static uint32_t depth_span_avx2(const DepthSpan &span, float *zrow, uint32_t &passed) {
+	// or-ing the edges leaves the sign bit set in lanes outside any edge
+	__m256i out_lo = _mm256_setzero_si256();
+	__m256i out_hi = _mm256_setzero_si256();
+	for (int k = 0; k < 3; ++k) {
+		int64_t e = span.e[k], s = span.step[k];
+		__m256i lo = _mm256_setr_epi64x(e, e + s, e + 2 * s, e + 3 * s);
+		__m256i hi = _mm256_add_epi64(lo, _mm256_set1_epi64x(4 * s));
+		out_lo = _mm256_or_si256(out_lo, lo);
+		out_hi = _mm256_or_si256(out_hi, hi);
+	}
+	uint32_t outside = _mm256_movemask_pd(_mm256_castsi256_pd(out_lo)) 
+					 | _mm256_movemask_pd(_mm256_castsi256_pd(out_hi)) << 4;
+	uint32_t covered = ~outside & span.lanes & 0xff;
+	passed = 0;
+	if (!covered)
+		return 0;
+
+	__m256 fx = _mm256_add_ps(_mm256_set1_ps(span.fx), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256 d  = _mm256_add_ps(_mm256_set1_ps(span.z), _mm256_mul_ps(_mm256_set1_ps(span.dzdx), fx));
+	__m256 z  = _mm256_loadu_ps(zrow);
+	__m256 test;
+	switch (span.func) {
+		case DEPTH_LESS:    test = _mm256_cmp_ps(d, z, _CMP_LT_OQ); break;
+		case DEPTH_LEQUAL:  test = _mm256_cmp_ps(d, z, _CMP_LE_OQ); break;
+		case DEPTH_EQUAL:   test = _mm256_cmp_ps(d, z, _CMP_EQ_OQ); break;
+		case DEPTH_GEQUAL:  test = _mm256_cmp_ps(d, z, _CMP_GE_OQ); break;
+		case DEPTH_GREATER: test = _mm256_cmp_ps(d, z, _CMP_GT_OQ); break;
+		default:            test = _mm256_castsi256_ps(_mm256_set1_epi32(-1)); break;
+	}
+	__m256 ok = _mm256_and_ps(test,
+			   _mm256_and_ps(_mm256_cmp_ps(d, _mm256_set1_ps(-1.f), _CMP_GE_OQ), 
+							 _mm256_cmp_ps(d, _mm256_set1_ps( 1.f), _CMP_LE_OQ)));
+	passed = _mm256_movemask_ps(ok) & covered;
+	if (passed && span.write) {
+		const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+		__m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(passed), bits), bits);
+		_mm256_maskstore_ps(zrow, mask, d);
+	}
+	return covered;
+}
+#endif
+
+depth_span_fn depth_span_kernel() {
+#ifdef KERNEL_AVX2
+	static const depth_span_fn kernel = __builtin_cpu_supports("avx2") ? depth_span_avx2 : depth_span_scalar;
+	return kernel;
+#else
+	return depth_span_scalar;
+#endif
+}
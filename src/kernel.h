@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include "global.h"
+
+// lanes processed by one call of a raster kernel, a tile row of the buffers
+const int KERNEL_WIDTH = 8;
+
+/**
+ * KERNEL_WIDTH consecutive pixels of one row and one sample index.
+ * lane i is covered if e[k] + i * step[k] >= 0 for all three edges,
+ * its depth is z + dzdx * (fx + i), it passes if func(depth, zrow[i]).
+ * without write the passing lanes are only reported, e.g. for a depth written after shading.
+ */
+struct DepthSpan {
+	int64_t   e[3];
+	int64_t   step[3];
+	float     z;
+	float     dzdx;
+	float     fx;
+	uint32_t  lanes;		// lanes that may be covered, one bit per lane
+	DepthFunc func  = DEPTH_GREATER;
+	bool      write = true;
+};
+
+/**
+ * @brief coverage, depth test and depth write of a span
+ * 
+ * @param zrow depth of the span's KERNEL_WIDTH lanes, passing lanes are overwritten if span.write
+ * @param passed the lanes that were covered, in [-1, 1] and passing the depth func
+ * @return the covered lanes
+ */
+using depth_span_fn = uint32_t (*)(const DepthSpan& span, float* zrow, uint32_t& passed);
+
+uint32_t depth_span_scalar(const DepthSpan& span, float* zrow, uint32_t& passed);
+
+// the fastest kernel the cpu supports, checked once at the first call
+depth_span_fn depth_span_kernel();
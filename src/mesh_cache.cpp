@@ -0,0 +1,225 @@
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mesh_cache.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char     CACHE_MAGIC[4] = {'M', 'S', 'H', 'C'};
+const uint32_t CACHE_VERSION  = 3;
+const size_t   CACHE_ALIGN    = 64;
+
+enum { VERTS, TEX_COORD, NORMS, FACET_VRT, FACET_TEX, FACET_NRM, FACET_IDX, FIRST_CORNER, 
+	   TANGENTS, BITANGENTS, NARRAYS };
+
+struct CacheHeader {
+	char     magic[4];
+	uint32_t version;
+	uint32_t vec_size;		// sizeof(vec3f), the arrays are stored as in memory
+	uint32_t narrays;
+	uint64_t src_size;
+	int64_t  src_mtime;
+	uint64_t src_hash;
+	uint64_t offset[NARRAYS];
+	uint64_t count[NARRAYS];
+};
+
+struct SourceStamp {
+	uint64_t size  = 0;
+	int64_t  mtime = 0;
+	bool     ok    = false;
+};
+
+SourceStamp stamp(const std::string& src) {
+	std::error_code ec;
+	SourceStamp s;
+	s.size  = fs::file_size(src, ec);
+	if (ec)
+		return s;
+	s.mtime = fs::last_write_time(src, ec).time_since_epoch().count();
+	s.ok    = !ec;
+	return s;
+}
+
+uint64_t hash_file(const std::string& src) {
+	MappedFile f(src);
+	return f.valid() ? fnv1a(f.data(), f.size()) : 0;
+}
+
+/**
+ * write(out) fills a temporary next to path, which is then renamed over path.
+ * a reader never maps a partial cache, and the temporary is named after the
+ * process so two processes building the same cache don't write into one file
+ */
+template<typename WriteF> bool replace_file(const std::string& path, WriteF write) {
+	std::string tmp = path + "." + std::to_string(::getpid()) + ".tmp";
+	std::error_code ec;
+	{
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		write(out);
+		if (!out) {
+			out.close();
+			fs::remove(tmp, ec);
+			return false;
+		}
+	}
+	fs::rename(tmp, path, ec);
+	if (ec) {
+		fs::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
+
+// element size of every array
+const size_t ELEM_SIZE[NARRAYS] = {sizeof(vec3f), sizeof(vec2f), sizeof(vec3f), sizeof(int), sizeof(int), 
+								   sizeof(int), sizeof(int), sizeof(int), sizeof(vec3f), sizeof(vec3f)};
+
+template<typename T> void set_view(Span<const T>& v, const uint8_t* base, const CacheHeader& h, int id) {
+	v = Span<const T>{reinterpret_cast<const T*>(base + h.offset[id]), int(h.count[id])};
+}
+
+} // namespace
+
+MeshView::MeshView(const MeshData &d)
+	: verts{d.verts.data(), int(d.verts.size())}
+	, tex_coord{d.tex_coord.data(), int(d.tex_coord.size())}
+	, norms{d.norms.data(), int(d.norms.size())}
+	, facet_vrt{d.facet_vrt.data(), int(d.facet_vrt.size())}
+	, facet_tex{d.facet_tex.data(), int(d.facet_tex.size())}
+	, facet_nrm{d.facet_nrm.data(), int(d.facet_nrm.size())}
+	, facet_idx{d.facet_idx.data(), int(d.facet_idx.size())}
+	, first_corner{d.first_corner.data(), int(d.first_corner.size())}
+	, tangents{d.tangents.data(), int(d.tangents.size())}
+	, bitangents{d.bitangents.data(), int(d.bitangents.size())} { }
+
+MappedFile::MappedFile(const std::string &path) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+	struct stat st;
+	if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+		void* p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			ptr = static_cast<const uint8_t*>(p);
+			len = st.st_size;
+		}
+	}
+	::close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (ptr)
+		::munmap(const_cast<uint8_t*>(ptr), len);
+}
+
+uint64_t fnv1a(const uint8_t *data, size_t len, uint64_t hash) {
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+std::string mesh_cache_path(const std::string &src) {
+	return src + ".mcache";
+}
+
+bool write_mesh_cache(const std::string &src, const MeshData &mesh) {
+	SourceStamp s = stamp(src);
+	if (!s.ok)
+		return false;
+
+	CacheHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+	h.version   = CACHE_VERSION;
+	h.vec_size  = sizeof(vec3f);
+	h.narrays   = NARRAYS;
+	h.src_size  = s.size;
+	h.src_mtime = s.mtime;
+	h.src_hash  = hash_file(src);
+
+	const void* arrays[NARRAYS] = {
+		mesh.verts.data(), mesh.tex_coord.data(), mesh.norms.data(), mesh.facet_vrt.data(), 
+		mesh.facet_tex.data(), mesh.facet_nrm.data(), mesh.facet_idx.data(), mesh.first_corner.data(),
+		mesh.tangents.data(), mesh.bitangents.data()
+	};
+	size_t bytes[NARRAYS] = {
+		mesh.verts.size() * sizeof(vec3f), mesh.tex_coord.size() * sizeof(vec2f), 
+		mesh.norms.size() * sizeof(vec3f), mesh.facet_vrt.size() * sizeof(int), 
+		mesh.facet_tex.size() * sizeof(int), mesh.facet_nrm.size() * sizeof(int), 
+		mesh.facet_idx.size() * sizeof(int), mesh.first_corner.size() * sizeof(int),
+		mesh.tangents.size() * sizeof(vec3f), mesh.bitangents.size() * sizeof(vec3f)
+	};
+	uint64_t off = (sizeof(h) + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+	for (int i = 0; i < NARRAYS; ++i) {
+		h.offset[i] = off;
+		h.count[i]  = bytes[i] / ELEM_SIZE[i];
+		off = (off + bytes[i] + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+	}
+
+	return replace_file(mesh_cache_path(src), [&](std::ofstream& out) {
+		static const char zeros[CACHE_ALIGN] = {};
+		out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		uint64_t pos = sizeof(h);
+		for (int i = 0; i < NARRAYS; ++i) {
+			out.write(zeros, h.offset[i] - pos);
+			out.write(static_cast<const char*>(arrays[i]), bytes[i]);
+			pos = h.offset[i] + bytes[i];
+		}
+	});
+}
+
+std::shared_ptr<const MappedFile> map_mesh_cache(const std::string &src, MeshView &view) {
+	SourceStamp s = stamp(src);
+	if (!s.ok)
+		return nullptr;
+	auto file = std::make_shared<const MappedFile>(mesh_cache_path(src));
+	if (!file->valid() || file->size() < sizeof(CacheHeader))
+		return nullptr;
+
+	CacheHeader h;
+	std::memcpy(&h, file->data(), sizeof(h));
+	if (std::memcmp(h.magic, CACHE_MAGIC, sizeof(h.magic)) || h.version != CACHE_VERSION || 
+		h.vec_size != sizeof(vec3f) || h.narrays != NARRAYS || h.src_size != s.size)
+		return nullptr;
+	for (int i = 0; i < NARRAYS; ++i) {
+		if (h.offset[i] % CACHE_ALIGN || h.count[i] > uint64_t(INT32_MAX) ||
+			h.offset[i] + h.count[i] * ELEM_SIZE[i] > file->size())
+			return nullptr;
+	}
+	if (h.src_mtime != s.mtime) {
+		if (h.src_hash != hash_file(src))
+			return nullptr;
+		// the source was only touched, store its new mtime so the next load skips the hash.
+		// a new file replaces the mapped one, which keeps its contents until unmapped
+		h.src_mtime = s.mtime;
+		replace_file(mesh_cache_path(src), [&](std::ofstream& out) {
+			out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+			out.write(reinterpret_cast<const char*>(file->data() + sizeof(h)), file->size() - sizeof(h));
+		});
+	}
+
+	const uint8_t* base = file->data();
+	set_view(view.verts,        base, h, VERTS);
+	set_view(view.tex_coord,    base, h, TEX_COORD);
+	set_view(view.norms,        base, h, NORMS);
+	set_view(view.facet_vrt,    base, h, FACET_VRT);
+	set_view(view.facet_tex,    base, h, FACET_TEX);
+	set_view(view.facet_nrm,    base, h, FACET_NRM);
+	set_view(view.facet_idx,    base, h, FACET_IDX);
+	set_view(view.first_corner, base, h, FIRST_CORNER);
+	set_view(view.tangents,     base, h, TANGENTS);
+	set_view(view.bitangents,   base, h, BITANGENTS);
+	return file;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "geometry.h"
+#include "buffer.h"
+
+// the arrays of a Model, as built by parsing an obj file. attributes are stored
+// as float, Model hands them out as double
+struct MeshData {
+	std::vector<vec3f> verts{};			// array of vertices
+	std::vector<vec2f> tex_coord{}; 	// per-vertex array of tex coords
+	std::vector<vec3f> norms{};			// per-vertex array of notmal vectors
+	std::vector<int>  facet_vrt{};
+	std::vector<int>  facet_tex{};		// per-triangle indices in the above arrays
+	std::vector<int>  facet_nrm{};
+	std::vector<int>  facet_idx{};		// per-triangle indices of unique vertexs
+	std::vector<int>  first_corner{};	// first corner of each unique vertex
+	std::vector<vec3f> tangents{};		// per unique vertex directions of increasing u
+	std::vector<vec3f> bitangents{};	// and v in the surface, normalized
+};
+
+// read-only views of the same arrays, into a MeshData or a mapped cache file
+struct MeshView {
+	Span<const vec3f> verts{};
+	Span<const vec2f> tex_coord{};
+	Span<const vec3f> norms{};
+	Span<const int>  facet_vrt{};
+	Span<const int>  facet_tex{};
+	Span<const int>  facet_nrm{};
+	Span<const int>  facet_idx{};
+	Span<const int>  first_corner{};
+	Span<const vec3f> tangents{};
+	Span<const vec3f> bitangents{};
+
+	MeshView() = default;
+	explicit MeshView(const MeshData& d);
+};
+
+// a whole file mapped read-only, invalid if it can't be opened
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& path);
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+	bool valid() const { return ptr != nullptr; }
+	const uint8_t* data() const { return ptr; }
+	size_t size() const { return len; }
+private:
+	const uint8_t* ptr = nullptr;
+	size_t len = 0;
+};
+
+/**
+ * binary cache of a mesh next to its source, "<src>.mcache":
+ * 	header : magic, version, sizeof(vec3f), and the size, mtime and
+ * 			 64 bit FNV-1a hash of the source file
+ * 	arrays : the MeshData arrays in memory layout, each 64 byte aligned
+ * the cache is valid if the source has the same size, and the same mtime
+ * or the same hash, so a touched but unchanged source keeps its cache.
+ */
+std::string mesh_cache_path(const std::string& src);
+
+// write the cache of src, returns false if it can't be written
+bool write_mesh_cache(const std::string& src, const MeshData& mesh);
+
+// map the cache of src and point view into it, nullptr if there is no valid cache
+std::shared_ptr<const MappedFile> map_mesh_cache(const std::string& src, MeshView& view);
+
+// 64 bit FNV-1a
+uint64_t fnv1a(const uint8_t* data, size_t len, uint64_t hash = 0xcbf29ce484222325ull);
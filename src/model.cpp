@@ -1,148 +1,155 @@
-#include <iostream>
-#include <sstream>
+#include <unordered_map>
 #include "model.h"
+#include "obj_loader.h"
 
 Model::Model(const std::string filename) {
-	std::ifstream in;
-	in.open(filename, std::ifstream::in);
-	if (in.fail())
+	mapped = map_mesh_cache(filename, mesh);
+	if (mapped)
 		return;
-	std::string line;
-	std::string s;
-	while (!in.eof()) {
-		std::getline(in, line);
-		std::istringstream iss(line.c_str());
-		char trash;
-		if (!line.compare(0, 2, "v ")) {
-			iss >> trash;
-			vec3 v;
-			for (int i = 0; i < 3; ++i)
-				iss >> v[i];
-			verts.push_back(v);
-		}
-		else if (!line.compare(0, 3, "vt ")) {
-			iss >> trash >> trash;
-			vec2 vt;
-			for (int i = 0; i < 2; ++i)
-				iss >> vt[i];
-			tex_coord.push_back(vt);
-		}
-		else if (!line.compare(0, 3, "vn ")) {
-			iss >> trash >> trash;
-			vec3 vn;
-			for (int i = 0; i < 3; ++i)
-				iss >> vn[i];
-			norms.push_back(vn);
-		}
-		else if (!line.compare(0, 2, "f ")) {
-			iss >> trash;
-			int v, vt, vn;
-			int cnt = 0;
-
-			while (iss >> s) {
-				size_t p1 = s.find_first_of('/');
-				size_t p2 = s.find_last_of('/');
-				if (p1 + 1 < p2 && p1 != std::string::npos) {		// f v/vt/vn
-					v = std::stoi(s.substr(0, p1));
-					vt = std::stoi(s.substr(p1 + 1, p2 - p1 - 1));
-					vn = std::stoi(s.substr(p2 + 1, s.size() - p2 - 1));
-
-					facet_vrt.push_back(--v);
-					facet_tex.push_back(--vt);
-					facet_nrm.push_back(--vn);
-				} else if (p1 + 1 == p2) {		// f v//vn
-					v = std::stoi(s.substr(0, p1));
-					vn = std::stoi(s.substr(p2 + 1, s.size() - p2 - 1));
-
-					facet_vrt.push_back(--v);
-					facet_nrm.push_back(--vn);
-				} else if (p1 == p2 && p1 != std::string::npos) {	// f v/vt
-					v = std::stoi(s.substr(0, p1));
-					vt = std::stoi(s.substr(p2 + 1, s.size() - p2 - 1));
-
-					facet_vrt.push_back(--v);
-					facet_tex.push_back(--vt);
-				} else if (p1 == p2 && p1 == std::string::npos) {	// f v
-					v = std::stoi(s);
-					facet_vrt.push_back(--v);
-				}
-				++cnt;
-			}
-
-			if (3 != cnt) {
-				std::cerr << "Error: the obj file is supposed to be trangulated" << std::endl; 
-				in.close(); 
-				return;
-			}
-		}
-	}
-	if (norms.size() == 0)
-		gen_normal();
-	in.close();
+	auto d = std::make_shared<MeshData>();
+	if (!load_obj(filename, *d))
+		return;
+	// normals listed but not referenced by the faces are no use either
+	if (d->norms.size() == 0 || d->facet_nrm.size() != d->facet_vrt.size())
+		gen_normal(*d);
+	gen_index(*d);
+	gen_tangent(*d);
+	write_mesh_cache(filename, *d);
+	owned = d;
+	mesh  = MeshView(*d);
 }
 
 void Model::draw(IShader &shader, const mat4 &vp, DepthBuffer &depth_buf, 
 				 ColorBuffer *color_buf, Triangle::AA_Format aa_f) {
-	for (int i = 0; i < nfaces(); ++i) {
-		vec4 clip_coord[3];
-		for (int j = 0; j < 3; ++j) {
-			clip_coord[j] = shader.vertex(i, j);
-		}
-		Triangle t(clip_coord);
-		if (gl_blend)
-			t.enable(GL_BLEND);
-		t.draw(shader, vp, depth_buf, color_buf, aa_f);
-	}
+	TileBins bins = bin(shader, vp, depth_buf.width(), depth_buf.height(),
+						 (color_buf && rstate.color_mask) || shader.late_z);
+	bins.draw(shader, depth_buf, color_buf, aa_f);
+	dstats = bins.stats();
 }
 
 void Model::enable(const uint16_t &feature) {
 	if (feature & GL_BLEND)
-		gl_blend = true;
+		rstate.blend = true;
 }
 
-int Model::nverts() const {
-	return verts.size();
+void Model::cull_face(CullMode mode) {
+	rstate.cull = mode;
 }
 
-int Model::nfaces() const {
-	return facet_vrt.size() / 3;
+int Model::nverts() const {
+	return mesh.verts.size();
 }
 
-vec3 Model::normal(const int iface, const int nthvert) const {
-	return norms[facet_nrm[iface * 3 + nthvert]];
+int Model::nfaces() const {
+	return mesh.facet_vrt.size() / 3;
 }
 
-
-vec3 Model::vert(const int i) const {
-	return verts[i];
+int Model::nunique_verts() const {
+	return mesh.first_corner.size();
 }
 
-vec3 Model::vert(const int iface, const int nthvert) const {
-	return verts[facet_vrt[iface * 3 + nthvert]];
+int Model::unique_vert(const int iface, const int nthvert) const {
+	return mesh.facet_idx[iface * 3 + nthvert];
 }
 
-vec2 Model::uv(const int iface, const int nthvert) const {
-	return tex_coord[facet_tex[iface * 3 + nthvert]];
+int Model::corner(const int i) const {
+	return mesh.first_corner[i];
 }
 
-void Model::gen_normal() {
-	facet_nrm = facet_vrt;
-	norms.assign(nverts(), vec3(0, 0, 0));
+void Model::gen_normal(MeshData &d) {
+	int nv = d.verts.size();
+	int nf = d.facet_vrt.size() / 3;
+	d.facet_nrm = d.facet_vrt;
+	std::vector<vec3> norms(nv, vec3(0, 0, 0));
 	vec3 pts[3];
-	std::vector<float> tot_areas(nverts(), 0);
-	for (int i = 0; i < nfaces(); ++i) {
+	std::vector<float> tot_areas(nv, 0);
+	for (int i = 0; i < nf; ++i) {
 		for (int j = 0; j < 3; ++j) {
-			pts[j] = vert(i, j);
+			pts[j] = vec3(d.verts[d.facet_vrt[i * 3 + j]]);
 		}
 		float cur_area = area(pts);
 		vec3  cur_normal = cross(pts[1] - pts[0], pts[2] - pts[0]).normalize();
 		for (int j = 0; j < 3; ++j) {
-			int idx = facet_vrt[i * 3 + j];
+			int idx = d.facet_vrt[i * 3 + j];
 			tot_areas[idx] += cur_area;
 			norms[idx] = norms[idx] + cur_normal * cur_area;
 		}
 	}
-	for (int i = 0; i < nverts(); ++i) {
-		norms[i] = norms[i] / tot_areas[i];
+	d.norms.resize(nv);
+	for (int i = 0; i < nv; ++i) {
+		d.norms[i] = vec3f(norms[i] / tot_areas[i]);
+	}
+}
+
+void Model::gen_index(MeshData &d) {
+	// corners with the same v/vt/vn share the transformed vertex
+	struct Key {
+		int v, vt, vn;
+		bool operator==(const Key& o) const { return v == o.v && vt == o.vt && vn == o.vn; }
+	};
+	struct Hash {
+		size_t operator()(const Key& k) const {
+			return (size_t(k.v) * 73856093) ^ (size_t(k.vt) * 19349663) ^ (size_t(k.vn) * 83492791);
+		}
+	};
+	std::unordered_map<Key, int, Hash> ids;
+	int ncorners = d.facet_vrt.size() / 3 * 3;
+	ids.reserve(ncorners);
+	d.facet_idx.resize(ncorners);
+	d.first_corner.clear();
+	for (int i = 0; i < ncorners; ++i) {
+		Key k{d.facet_vrt[i],
+			  i < int(d.facet_tex.size()) ? d.facet_tex[i] : -1,
+			  i < int(d.facet_nrm.size()) ? d.facet_nrm[i] : -1};
+		auto it = ids.emplace(k, int(d.first_corner.size()));
+		if (it.second)
+			d.first_corner.push_back(i);
+		d.facet_idx[i] = it.first->second;
+	}
+}
+
+void Model::gen_tangent(MeshData &d) {
+	int nu = d.first_corner.size();
+	int nf = d.facet_vrt.size() / 3;
+	std::vector<vec3> t(nu, vec3(0, 0, 0)), b(nu, vec3(0, 0, 0));
+	// faces without vt have no uv gradients, their tangents stay zero
+	if (!d.tex_coord.empty() && d.facet_tex.size() == size_t(nf) * 3) {
+		for (int i = 0; i < nf; ++i) {
+			vec3 p[3];
+			vec2 uv[3];
+			for (int j = 0; j < 3; ++j) {
+				p[j]  = vec3(d.verts[d.facet_vrt[i * 3 + j]]);
+				uv[j] = vec2(d.tex_coord[d.facet_tex[i * 3 + j]]);
+			}
+			// the gradients of u and v in the face's plane
+			mat3 A;
+			A[0] = p[1] - p[0];
+			A[1] = p[2] - p[0];
+			A[2] = cross(A[0], A[1]);
+			double area2 = A[2].norm();
+			if (area2 < 1e-12)
+				continue;
+			A = A.invert();
+			vec3 gu = A * vec3(uv[1].x - uv[0].x, uv[2].x - uv[0].x, 0);
+			vec3 gv = A * vec3(uv[1].y - uv[0].y, uv[2].y - uv[0].y, 0);
+			if (gu.norm2() == 0 || gv.norm2() == 0)
+				continue;
+			// area weighted like the generated normals
+			for (int j = 0; j < 3; ++j) {
+				int idx = d.facet_idx[i * 3 + j];
+				t[idx] = t[idx] + gu.normalize() * area2;
+				b[idx] = b[idx] + gv.normalize() * area2;
+			}
+		}
+	}
+	d.tangents.resize(nu);
+	d.bitangents.resize(nu);
+	for (int i = 0; i < nu; ++i) {
+		// remove the part along the vertex normal, every corner has one after gen_normal()
+		vec3 n = vec3(d.norms[d.facet_nrm[d.first_corner[i]]]).normalize();
+		vec3 ti = t[i] - n * dot(n, t[i]);
+		vec3 bi = b[i] - n * dot(n, b[i]);
+		d.tangents[i]   = ti.norm2() > 0 ? vec3f(ti.normalize()) : vec3f(0, 0, 0);
+		d.bitangents[i] = bi.norm2() > 0 ? vec3f(bi.normalize()) : vec3f(0, 0, 0);
 	}
-}
\ No newline at end of file
+}
@@ -2,10 +2,13 @@
 #include <vector>
 #include <string>
 #include <optional>
+#include <memory>
 #include "geometry.h"
 #include "tgaimage.h"
 #include "gl.h"
 #include "triangle.h"
+#include "binning.h"
+#include "mesh_cache.h"
 
 /**
  vertex : v {x} {y} {z} [w]	; w is optional and defaults to 1.0
@@ -14,30 +17,130 @@
 		example : vt 0.500 0.123 0.231
  vertex normals : vn {x} {y} {z}
  		example : vn  0.001 0.482 -0.876
- face element : f {v}/[vt]/[vn]
+ face element : f {v}/[vt]/[vn] ...	; 3 or more vertexs, an index < 0 counts back from the last one
 		example : f 6/4/1 3/5/3 7/6/5
 
+the parsed arrays are cached in a binary file next to the obj, later
+loads map that file and use its arrays in place.
 */
 class Model {
 public:
 	Model(const std::string filename); 
 	void draw(IShader& shader, const mat4& vp, DepthBuffer& depth_buf, 
 			  ColorBuffer *color_buf, Triangle::AA_Format aa_f = Triangle::NOAA);
+	// the shader type and the sample count known at compile time, so the
+	// shader inlines into the raster loops. e.g. draw<Shader, Triangle::MSAA4>(...)
+	template<typename ShaderT, Triangle::AA_Format AA = Triangle::NOAA>
+	void draw(ShaderT& shader, const mat4& vp, DepthBuffer& depth_buf, ColorBuffer *color_buf);
+	// run the vertex shader over all faces and bin the triangles for a width x height screen.
+	// without keep_varyings only the positions are kept, for a raster without fragment shader
+	template<typename ShaderT>
+	TileBins bin(ShaderT& shader, const mat4& vp, int width, int height, bool keep_varyings = true) const;
 	void enable(const uint16_t& feature);
+	// faces culled by winding in the following draws, CULL_NONE by default
+	void cull_face(CullMode mode);
+	// the whole fixed function state of the following draws, enable() and cull_face() change parts of it
+	void set_state(const RenderState& s) { rstate = s; }
+	const RenderState& state() const { return rstate; }
 	int nverts() const;
 	int nfaces() const;
-	vec3 normal(const int iface, const int nthvert) const; 	// per triangle corner normal vertex
-	vec3 vert(const int i) const;
-	vec3 vert(const int iface, const int nthvert) const;
-	vec2 uv(const int iface, const int nthvert) const;
+	// the attributes are stored as float, T = float reads them without conversion,
+	// e.g. for a vertex stage in mat4f * vec4f
+	template<typename T = double> vec<3, T> normal(const int iface, const int nthvert) const; 	// per triangle corner normal vertex
+	template<typename T = double> vec<3, T> vert(const int i) const;
+	template<typename T = double> vec<3, T> vert(const int iface, const int nthvert) const;
+	template<typename T = double> vec<2, T> uv(const int iface, const int nthvert) const;
+	// unit directions of increasing u and v at a corner, in the surface of the mesh.
+	// with the normal they map a tangent space normal map to model space
+	template<typename T = double> vec<3, T> tangent(const int iface, const int nthvert) const;
+	template<typename T = double> vec<3, T> bitangent(const int iface, const int nthvert) const;
+	// corners with the same v/vt/vn are one unique vertex
+	int nunique_verts() const;
+	int unique_vert(const int iface, const int nthvert) const;
+	int corner(const int i) const;		// iface * 3 + nthvert of the first corner of unique vertex i
+	// geometry work of the last draw
+	const DrawStats& stats() const { return dstats; }
 private:
-	void gen_normal();
-
-	bool gl_blend = false;
-	std::vector<vec3> verts{};		// array of vertices
-	std::vector<vec2> tex_coord{}; 	// per-vertex array of tex coords
-	std::vector<vec3> norms{};		// per-vertex array of notmal vectors
-	std::vector<int> facet_vrt{};
-	std::vector<int> facet_tex{};	// per-triangle indices in the above arrays
-	std::vector<int> facet_nrm{};
+	static void gen_normal(MeshData& d);
+	static void gen_index(MeshData& d);
+	static void gen_tangent(MeshData& d);
+
+	MeshView mesh{};		// into owned or mapped, copies of a Model share them
+	std::shared_ptr<const MeshData>   owned{};
+	std::shared_ptr<const MappedFile> mapped{};
+	RenderState rstate{};
+	DrawStats dstats{};
 };
+
+template<typename T> vec<3, T> Model::normal(const int iface, const int nthvert) const {
+	return vec<3, T>(mesh.norms[mesh.facet_nrm[iface * 3 + nthvert]]);
+}
+
+template<typename T> vec<3, T> Model::vert(const int i) const {
+	return vec<3, T>(mesh.verts[i]);
+}
+
+template<typename T> vec<3, T> Model::vert(const int iface, const int nthvert) const {
+	return vec<3, T>(mesh.verts[mesh.facet_vrt[iface * 3 + nthvert]]);
+}
+
+template<typename T> vec<2, T> Model::uv(const int iface, const int nthvert) const {
+	return vec<2, T>(mesh.tex_coord[mesh.facet_tex[iface * 3 + nthvert]]);
+}
+
+template<typename T> vec<3, T> Model::tangent(const int iface, const int nthvert) const {
+	return vec<3, T>(mesh.tangents[mesh.facet_idx[iface * 3 + nthvert]]);
+}
+
+template<typename T> vec<3, T> Model::bitangent(const int iface, const int nthvert) const {
+	return vec<3, T>(mesh.bitangents[mesh.facet_idx[iface * 3 + nthvert]]);
+}
+
+template<typename ShaderT, Triangle::AA_Format AA>
+void Model::draw(ShaderT &shader, const mat4 &vp, DepthBuffer &depth_buf, ColorBuffer *color_buf) {
+	TileBins bins = bin(shader, vp, depth_buf.width(), depth_buf.height(),
+						 (color_buf && rstate.color_mask) || shader.late_z);
+	bins.draw<ShaderT, AA>(shader, depth_buf, color_buf);
+	dstats = bins.stats();
+}
+
+template<typename ShaderT>
+TileBins Model::bin(ShaderT &shader, const mat4 &vp, int width, int height, bool keep_varyings) const {
+	TileBins bins(width, height);
+	bins.set_state(rstate);
+	// vertex stage, once per unique vertex
+	int nv = keep_varyings ? std::max(shader.nvaryings(), 0) : 0;
+	std::vector<vec4>   clip(nunique_verts());
+	std::vector<double> varyings(size_t(nv) * clip.size());
+	for (int i = 0; i < nunique_verts(); ++i) {
+		int c = corner(i);
+		clip[i] = shader_vertex(shader, c / 3, c % 3);
+		if (nv > 0)
+			shader.save_varyings(c % 3, &varyings[size_t(i) * nv]);
+	}
+
+	// primitive assembly from the indices, culling before any setup
+	DrawStats stats{nunique_verts(), nfaces() * 3 - nunique_verts()};
+	for (int i = 0; i < nfaces(); ++i) {
+		int idx[3];
+		for (int j = 0; j < 3; ++j)
+			idx[j] = unique_vert(i, j);
+		Triangle t(clip[idx[0]], clip[idx[1]], clip[idx[2]]);
+		if (t.outside()) {
+			++stats.outside;
+			continue;
+		}
+		if (t.cull(rstate.cull)) {
+			++stats.culled;
+			continue;
+		}
+		Triangle parts[Triangle::MAX_CLIP_PARTS];
+		int n = t.clip(vp, parts);
+		for (int k = 0; k < n; ++k)
+			bins.push(i, parts[k], idx);
+	}
+	if (keep_varyings && shader.nvaryings() >= 0)
+		bins.set_varyings(std::move(varyings), nv);
+	bins.set_stats(stats);
+	return bins;
+}
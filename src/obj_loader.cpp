@@ -0,0 +1,216 @@
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include "obj_loader.h"
+
+namespace {
+
+// chunks are about this large, so the threads get balanced work
+const size_t CHUNK_BYTES = 1 << 20;
+
+// a face corner, indices of v, vt and vn, -1 if absent.
+// bit k of rel is set if index k is relative to the chunk's first element
+struct Corner {
+	int     idx[3];
+	uint8_t rel;
+};
+
+struct Chunk {
+	std::vector<vec3f>  verts{};
+	std::vector<vec2f>  tex_coord{};
+	std::vector<vec3f>  norms{};
+	std::vector<Corner> corners{};		// 3 per triangle
+	const char* error = nullptr;		// first malformed line
+};
+
+inline bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline const char* skip_space(const char* p, const char* end) {
+	while (p < end && is_space(*p))
+		++p;
+	return p;
+}
+
+inline bool parse_double(const char*& p, const char* end, double& v) {
+	p = skip_space(p, end);
+	if (p < end && *p == '+')
+		++p;
+	auto r = std::from_chars(p, end, v);
+	if (r.ec != std::errc())
+		return false;
+	p = r.ptr;
+	return true;
+}
+
+// 1 if a corner was parsed, 0 at the end of the line, -1 if malformed
+int parse_corner(const char*& p, const char* end, const int count[3], Corner& c) {
+	p = skip_space(p, end);
+	if (p == end)
+		return 0;
+	c.rel = 0;
+	c.idx[0] = c.idx[1] = c.idx[2] = -1;
+	for (int k = 0; k < 3; ++k) {
+		if (k > 0) {
+			if (p == end || *p != '/')
+				break;
+			++p;
+			if (p < end && *p == '/')	// v//vn
+				continue;
+		}
+		int i;
+		auto r = std::from_chars(p, end, i);
+		if (r.ec != std::errc() || i == 0)
+			return -1;
+		p = r.ptr;
+		if (i > 0) {
+			c.idx[k] = i - 1;
+		} else {
+			c.idx[k] = count[k] + i;
+			c.rel |= 1 << k;
+		}
+	}
+	return (p == end || is_space(*p)) ? 1 : -1;
+}
+
+void parse_chunk(const char* p, const char* end, Chunk& ch) {
+	std::vector<Corner> poly;
+	while (p < end && !ch.error) {
+		const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+		if (!eol)
+			eol = end;
+		const char* line = p;
+		const char* q = skip_space(p, eol);
+		p = eol + 1;
+		size_t n = eol - q;
+
+		bool ok = true;
+		if (n >= 2 && q[0] == 'v' && is_space(q[1])) {
+			vec3 v;
+			q += 1;
+			for (int i = 0; i < 3; ++i)
+				ok = ok && parse_double(q, eol, v[i]);
+			ch.verts.push_back(vec3f(v));
+		} else if (n >= 3 && q[0] == 'v' && q[1] == 't' && is_space(q[2])) {
+			vec2 vt(0, 0);		// v defaults to 0
+			q += 2;
+			ok = parse_double(q, eol, vt[0]);
+			if (skip_space(q, eol) != eol)
+				ok = ok && parse_double(q, eol, vt[1]);
+			ch.tex_coord.push_back(vec2f(vt));
+		} else if (n >= 3 && q[0] == 'v' && q[1] == 'n' && is_space(q[2])) {
+			vec3 vn;
+			q += 2;
+			for (int i = 0; i < 3; ++i)
+				ok = ok && parse_double(q, eol, vn[i]);
+			ch.norms.push_back(vec3f(vn));
+		} else if (n >= 2 && q[0] == 'f' && is_space(q[1])) {
+			q += 1;
+			int count[3] = {int(ch.verts.size()), int(ch.tex_coord.size()), int(ch.norms.size())};
+			poly.clear();
+			Corner c;
+			int r;
+			while ((r = parse_corner(q, eol, count, c)) > 0)
+				poly.push_back(c);
+			ok = r == 0 && poly.size() >= 3;
+			// fan triangulation of quads and n-gons
+			for (size_t i = 1; ok && i + 1 < poly.size(); ++i) {
+				ch.corners.push_back(poly[0]);
+				ch.corners.push_back(poly[i]);
+				ch.corners.push_back(poly[i + 1]);
+			}
+		}
+		if (!ok)
+			ch.error = line;
+	}
+}
+
+} // namespace
+
+bool load_obj(const std::string &filename, MeshData &d) {
+	MappedFile file(filename);
+	if (!file.valid())
+		return false;
+	const char* text = reinterpret_cast<const char*>(file.data());
+	size_t size = file.size();
+
+	// chunk boundaries, each right after a newline
+	int nchunks = std::max<size_t>(1, size / CHUNK_BYTES);
+	std::vector<size_t> bounds(nchunks + 1, size);
+	bounds[0] = 0;
+	for (int i = 1; i < nchunks; ++i) {
+		const char* p = text + std::max(bounds[i - 1], size * i / nchunks);
+		const char* nl = static_cast<const char*>(std::memchr(p, '\n', text + size - p));
+		bounds[i] = nl ? nl - text + 1 : size;
+	}
+
+	std::vector<Chunk> chunks(nchunks);
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int i = 0; i < nchunks; ++i)
+		parse_chunk(text + bounds[i], text + bounds[i + 1], chunks[i]);
+
+	// first element of every chunk in the merged arrays
+	std::vector<size_t> base_v(nchunks + 1, 0), base_t(nchunks + 1, 0);
+	std::vector<size_t> base_n(nchunks + 1, 0), base_c(nchunks + 1, 0);
+	bool has_tex = false, has_nrm = false;
+	for (int i = 0; i < nchunks; ++i) {
+		const Chunk& ch = chunks[i];
+		if (ch.error) {
+			const char* eol = static_cast<const char*>(std::memchr(ch.error, '\n', text + size - ch.error));
+			std::cerr << "Error: malformed line in " << filename << ": " 
+					  << std::string(ch.error, eol ? eol : text + size) << std::endl;
+			return false;
+		}
+		base_v[i + 1] = base_v[i] + ch.verts.size();
+		base_t[i + 1] = base_t[i] + ch.tex_coord.size();
+		base_n[i + 1] = base_n[i] + ch.norms.size();
+		base_c[i + 1] = base_c[i] + ch.corners.size();
+		for (const Corner& c: ch.corners) {
+			has_tex = has_tex || c.idx[1] >= 0 || c.rel & 2;
+			has_nrm = has_nrm || c.idx[2] >= 0 || c.rel & 4;
+		}
+	}
+
+	d.verts.resize(base_v[nchunks]);
+	d.tex_coord.resize(base_t[nchunks]);
+	d.norms.resize(base_n[nchunks]);
+	d.facet_vrt.resize(base_c[nchunks]);
+	d.facet_tex.resize(has_tex ? base_c[nchunks] : 0);
+	d.facet_nrm.resize(has_nrm ? base_c[nchunks] : 0);
+	long nv = d.verts.size(), nt = d.tex_coord.size(), nn = d.norms.size();
+	bool in_range = true;
+	#pragma omp parallel for schedule(dynamic, 1) reduction(&&: in_range)
+	for (int i = 0; i < nchunks; ++i) {
+		const Chunk& ch = chunks[i];
+		std::copy(ch.verts.begin(),     ch.verts.end(),     d.verts.begin()     + base_v[i]);
+		std::copy(ch.tex_coord.begin(), ch.tex_coord.end(), d.tex_coord.begin() + base_t[i]);
+		std::copy(ch.norms.begin(),     ch.norms.end(),     d.norms.begin()     + base_n[i]);
+		for (size_t j = 0; j < ch.corners.size(); ++j) {
+			const Corner& c = ch.corners[j];
+			size_t k = base_c[i] + j;
+			long v  = c.idx[0] + (c.rel & 1 ? long(base_v[i]) : 0);
+			long vt = c.idx[1] + (c.rel & 2 ? long(base_t[i]) : 0);
+			long vn = c.idx[2] + (c.rel & 4 ? long(base_n[i]) : 0);
+			// a corner without vt or vn in a mesh that has them gets the first one
+			if (c.idx[1] < 0 && !(c.rel & 2))
+				vt = 0;
+			if (c.idx[2] < 0 && !(c.rel & 4))
+				vn = 0;
+			in_range = in_range && v >= 0 && v < nv;
+			d.facet_vrt[k] = v;
+			if (has_tex) {
+				in_range = in_range && vt >= 0 && vt < nt;
+				d.facet_tex[k] = vt;
+			}
+			if (has_nrm) {
+				in_range = in_range && vn >= 0 && vn < nn;
+				d.facet_nrm[k] = vn;
+			}
+		}
+	}
+	if (!in_range) {
+		std::cerr << "Error: face index out of range in " << filename << std::endl;
+		d = MeshData();
+		return false;
+	}
+	return true;
+}
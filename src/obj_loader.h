@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+#include "mesh_cache.h"
+
+/**
+ * @brief parse an obj file into d, in parallel over newline-aligned chunks
+ * 
+ * v, vt, vn and f lines are read, everything else is skipped. faces with
+ * more than 3 vertexs are split into a fan, negative indices count back
+ * from the last element defined before the face.
+ * @return false if the file can't be read or is malformed
+ */
+bool load_obj(const std::string& filename, MeshData& d);
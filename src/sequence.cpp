@@ -0,0 +1,51 @@
+#include <future>
+#include <limits>
+#include <cstdio>
+#include <iostream>
+#include "sequence.h"
+
+void FrameDraws::raster(DepthBuffer &zbuf, ColorBuffer &color_buf) {
+	for (auto& r: rasters)
+		r(zbuf, color_buf);
+}
+
+void SequenceRenderer::render(const CameraPath &path, int nframes, const Scene &scene,
+							  const std::string &pattern) {
+	auto geometry = [&](int k) {
+		auto draws = std::make_unique<FrameDraws>(w, h, aa);
+		double t = path.start() + (path.end() - path.start()) * k / nframes;
+		scene(k, path.at(t), *draws);
+		return draws;
+	};
+	auto encode = [this, &pattern](int k, std::unique_ptr<ColorBuffer> color_buf) {
+		TGAImage image(w, h, TGAImage::RGB);
+		resolve(*color_buf, image, resolve_filter);
+		std::vector<char> name(pattern.size() + 32);
+		std::snprintf(name.data(), name.size(), pattern.c_str(), k);
+		if (!image.write_tga_file(name.data()))
+			std::cerr << "write " << name.data() << " failed" << std::endl;
+		color_pool.release(std::move(color_buf));
+	};
+
+	std::future<std::unique_ptr<FrameDraws>> next;
+	std::future<void> written;
+	if (nframes > 0)
+		next = std::async(std::launch::async, geometry, 0);
+	for (int k = 0; k < nframes; ++k) {
+		std::unique_ptr<FrameDraws> draws = next.get();
+		if (k + 1 < nframes)
+			next = std::async(std::launch::async, geometry, k + 1);
+
+		std::unique_ptr<DepthBuffer> zbuf = depth_pool.acquire(w, h, -std::numeric_limits<float>::max(), aa);
+		std::unique_ptr<ColorBuffer> color_buf = color_pool.acquire(w, h, clear_color, aa);
+		draws->raster(*zbuf, *color_buf);
+		depth_pool.release(std::move(zbuf));
+
+		// one frame in flight in the encoder, its color buffer goes back to the pool when written
+		if (written.valid())
+			written.get();
+		written = std::async(std::launch::async, encode, k, std::move(color_buf));
+	}
+	if (written.valid())
+		written.get();
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <type_traits>
+#include "camera.h"
+#include "buffer.h"
+#include "model.h"
+#include "filter.h"
+
+/**
+ * the draws of one frame of a sequence. draw() runs the geometry stage of a model
+ * at once, vertex shader, clipping and binning, on a copy of the shader that is
+ * then kept for the raster. so the scene may change its models' state and its
+ * shaders' uniforms for the next frame while this one is still rasterizing.
+ */
+class FrameDraws {
+public:
+	FrameDraws(int width, int height, Triangle::AA_Format aa_f) : w(width), h(height), aa(aa_f) {}
+	template<typename ShaderT> void draw(const Model& model, const ShaderT& shader, const mat4& vp);
+	// rasterize the draws in the order they were added
+	void raster(DepthBuffer& zbuf, ColorBuffer& color_buf);
+private:
+	int w;
+	int h;
+	Triangle::AA_Format aa;
+	std::vector<std::function<void(DepthBuffer&, ColorBuffer&)>> rasters{};
+};
+
+template<typename ShaderT>
+void FrameDraws::draw(const Model& model, const ShaderT& shader, const mat4& vp) {
+	static_assert(std::is_copy_constructible_v<ShaderT>, "a frame keeps its own copy of the shader");
+	auto copy = std::make_shared<ShaderT>(shader);
+	auto bins = std::make_shared<TileBins>(model.bin(*copy, vp, w, h));
+	Triangle::AA_Format aa_f = aa;
+	rasters.push_back([copy, bins, aa_f](DepthBuffer& zbuf, ColorBuffer& color_buf) {
+		dispatch_aa(aa_f, [&](auto a) {
+			bins->template draw<ShaderT, decltype(a)::value>(*copy, zbuf, &color_buf);
+		});
+	});
+}
+
+/**
+ * render the frames of a camera path in one process, the assets are loaded once.
+ * the stages of consecutive frames overlap:
+ * 	geometry : scene() and the geometry of its draws, frame k + 1 on its own thread
+ * 	raster   : frame k on the calling thread, tiles in parallel as in Model::draw
+ * 	encode   : resolve and file write of frame k - 1 on its own thread
+ * render targets come from pools, so after the first frames nothing is allocated.
+ */
+class SequenceRenderer {
+public:
+	// adds the draws of frame k seen by camera, called in frame order on the geometry thread
+	using Scene = std::function<void(int frame, const Camera& camera, FrameDraws& draws)>;
+
+	SequenceRenderer(int width, int height, Triangle::AA_Format aa_f = Triangle::MSAA4,
+					 color_t clear = color_t(0, 0, 0, 0), ResolveFilter filter = RESOLVE_BOX)
+		: w(width), h(height), aa(aa_f), clear_color(clear), resolve_filter(filter) {}
+	/**
+	 * @brief render nframes, frame k at time start + k * (end - start) / nframes of the path,
+	 * so a looping path doesn't repeat its first frame
+	 *
+	 * @param pattern printf pattern of the file of a frame from its index, e.g. "frame_%04d.tga"
+	 */
+	void render(const CameraPath& path, int nframes, const Scene& scene, const std::string& pattern);
+private:
+	int w;
+	int h;
+	Triangle::AA_Format aa;
+	color_t clear_color;
+	ResolveFilter resolve_filter;
+	BufferPool<DepthBuffer> depth_pool{};
+	BufferPool<ColorBuffer> color_pool{};
+};
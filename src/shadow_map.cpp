@@ -0,0 +1,79 @@
+#include <cmath>
+#include <algorithm>
+#include "shadow_map.h"
+#include "buffer.h"
+#include "filter.h"
+
+// variance never drops under this, a flat occluder would otherwise shadow itself by rounding
+const float MIN_VARIANCE = 1e-6f;
+
+ShadowMap::ShadowMap(DepthBuffer& depth, ShadowFilter filter, int radius, float exponent)
+	: w(depth.width()), h(depth.height()), nc(filter == SHADOW_VSM ? 2 : 1)
+	, filter(filter), exponent(exponent), moments(size_t(w) * h * nc) {
+	int n = depth.simple_num();
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			double m1 = 0, m2 = 0;
+			for (int i = 0; i < n; ++i) {
+				// empty samples hold the clear value, they are on the far plane
+				double d = std::clamp(depth.get(x, y, i), -1.f, 1.f);
+				if (filter == SHADOW_VSM) {
+					m1 += d;
+					m2 += d * d;
+				}
+				else {
+					m1 += std::exp(-exponent * d);
+				}
+			}
+			float* t = &moments[(size_t(y) * w + x) * nc];
+			t[0] = m1 / n;
+			if (filter == SHADOW_VSM)
+				t[1] = m2 / n;
+		}
+	}
+	if (radius > 0)
+		blur(radius);
+}
+
+void ShadowMap::blur(int radius) {
+	// a box in x then in y, the moments of the edge texels repeat outside the map
+	std::vector<float> box(2 * radius + 1, 1.f / (2 * radius + 1));
+	std::vector<float> src(moments);
+	convolve_separable(src.data(), moments.data(), w, h, nc, box.data(), box.size(), 
+					   box.data(), box.size(), EDGE_CLAMP);
+}
+
+float ShadowMap::visibility(const vec2& uv, float depth) const {
+	if (moments.empty() || uv.x < 0 || uv.x > 1 || uv.y < 0 || uv.y > 1)
+		return 1;
+
+	// bilinear moments, clamped to the edge texels
+	float fx = uv.x * w - 0.5f, fy = uv.y * h - 0.5f;
+	int x0 = std::floor(fx), y0 = std::floor(fy);
+	float tx = fx - x0, ty = fy - y0;
+	int x1 = std::min(x0 + 1, w - 1), y1 = std::min(y0 + 1, h - 1);
+	x0 = std::max(x0, 0);
+	y0 = std::max(y0, 0);
+	const float* t00 = texel(x0, y0);
+	const float* t10 = texel(x1, y0);
+	const float* t01 = texel(x0, y1);
+	const float* t11 = texel(x1, y1);
+	float m[2];
+	for (int c = 0; c < nc; ++c) {
+		float top = t00[c] + (t10[c] - t00[c]) * tx;
+		float bot = t01[c] + (t11[c] - t01[c]) * tx;
+		m[c] = top + (bot - top) * ty;
+	}
+
+	if (filter == SHADOW_ESM)
+		return std::min(1.f, std::exp(exponent * depth) * m[0]);
+
+	float mean = m[0];
+	if (depth >= mean)
+		return 1;
+	float variance = std::max(m[1] - mean * mean, MIN_VARIANCE);
+	float d = mean - depth;
+	float p = variance / (variance + d * d);
+	return std::clamp((p - bleeding) / (1 - bleeding), 0.f, 1.f);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include "geometry.h"
+
+class DepthBuffer;
+
+/**
+ * how a shadow map turns filtered depth into visibility
+ * 	SHADOW_VSM : variance shadow map, the mean and the mean square of the depth,
+ * 				 visibility is the chebyshev upper bound of the receiver being in front
+ * 	SHADOW_ESM : exponential shadow map, the mean of exp(-k * depth),
+ * 				 visibility is exp(k * (receiver - occluder)) clamped to 1
+ */
+enum ShadowFilter { SHADOW_VSM, SHADOW_ESM };
+
+/**
+ * a prefiltered shadow map in float, built once from the depth buffer of the light.
+ * all the samples of a pixel go into its moments, which are then box blurred by a
+ * separable pass, so a single bilinear lookup answers what a radius x radius PCF
+ * kernel would. depth keeps the convention of the depth buffer, greater is nearer.
+ */
+class ShadowMap {
+public:
+	ShadowMap() = default;
+	/**
+	 * @param radius the blur covers (2 * radius + 1)^2 texels, 0 for no blur
+	 * @param exponent k of SHADOW_ESM, sharper contacts and less precision as it grows
+	 */
+	ShadowMap(DepthBuffer& depth, ShadowFilter filter = SHADOW_VSM, int radius = 3, float exponent = 40);
+	int width()  const { return w; }
+	int height() const { return h; }
+	/**
+	 * @brief fraction of light reaching a receiver, 1 outside the map
+	 *
+	 * @param uv position in the map, in [0, 1]
+	 * @param depth depth of the receiver in the light's ndc, bias included
+	 */
+	float visibility(const vec2& uv, float depth) const;
+	// SHADOW_VSM: cut the penumbra tails under amount, they show as light leaking behind occluders
+	void reduce_bleeding(float amount) { bleeding = amount; }
+private:
+	void blur(int radius);
+	const float* texel(int x, int y) const { return &moments[(size_t(y) * w + x) * nc]; }
+
+	int w  = 0;
+	int h  = 0;
+	int nc = 2;		// floats per texel
+	ShadowFilter filter = SHADOW_VSM;
+	float exponent = 40;
+	float bleeding = 0.2f;
+	std::vector<float> moments{};
+};
@@ -1,7 +1,114 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
 #include "texture.h"
 
-color_t Texture::sample(const vec2 &uv) {
+const float UNORM8[256] = {
+#define N4(n) float((n) / 255.0), float((n + 1) / 255.0), float((n + 2) / 255.0), float((n + 3) / 255.0)
+#define N16(n) N4(n), N4(n + 4), N4(n + 8), N4(n + 12)
+#define N64(n) N16(n), N16(n + 16), N16(n + 32), N16(n + 48)
+	N64(0), N64(64), N64(128), N64(192)
+#undef N64
+#undef N16
+#undef N4
+};
+
+TexLevel::TexLevel(int width, int height)
+	: w(width), h(height), tw((width + TEXTURE_TILE - 1) / TEXTURE_TILE)
+	, texels(size_t(tw) * ((height + TEXTURE_TILE - 1) / TEXTURE_TILE) * TEXTURE_TILE * TEXTURE_TILE, 0) {}
+
+TexLevel::TexLevel(const TGAImage &image) : TexLevel(image.width(), image.height()) {
+	const std::uint8_t* src = image.buffer();
+	int bpp = image.bytespp();
+	if (!src)
+		return;
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			std::uint8_t bgra[4] = {0, 0, 0, 255};
+			std::memcpy(bgra, src, bpp);
+			std::memcpy(&texels[index(x, y)], bgra, 4);
+			src += bpp;
+		}
+	}
+}
+
+TexLevel TexLevel::half() const {
+	TexLevel dst(std::max(w / 2, 1), std::max(h / 2, 1));
+	for (int y = 0; y < dst.h; ++y) {
+		for (int x = 0; x < dst.w; ++x) {
+			// the 2x2 block, a dimension of 1 repeats its only texel
+			int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+			int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+			const std::uint8_t* p[4] = {
+				reinterpret_cast<const std::uint8_t*>(&texels[index(x0, y0)]),
+				reinterpret_cast<const std::uint8_t*>(&texels[index(x1, y0)]),
+				reinterpret_cast<const std::uint8_t*>(&texels[index(x0, y1)]),
+				reinterpret_cast<const std::uint8_t*>(&texels[index(x1, y1)]),
+			};
+			std::uint8_t avg[4];
+			for (int c = 0; c < 4; ++c)
+				avg[c] = (p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4;
+			std::memcpy(&dst.texels[dst.index(x, y)], avg, 4);
+		}
+	}
+	return dst;
+}
+
+color_t Texture::sample(const vec2 &uv) const {
 	int x = image.width() * uv.x;
 	int y = image.height() * uv.y;
-	return image.get(x, y);
-}
\ No newline at end of file
+	return fetch(x, y);
+}
+
+void Texture::sample(const vec2 *uv, int n, color_t *out) const {
+	if (mips.empty()) {
+		std::fill(out, out + n, color_t());
+		return;
+	}
+	const TexLevel& level = mips[0];
+	double w = level.width(), h = level.height();
+	for (int i = 0; i < n; ++i)
+		out[i] = level.get(int(w * uv[i].x), int(h * uv[i].y));
+}
+
+color_t Texture::sample(const vec2 &uv, const vec2 &dx, const vec2 &dy) const {
+	if (mips.empty() || uv.x < 0 || uv.x > 1 || uv.y < 0 || uv.y > 1)	// same as the nearest sample outside
+		return {};
+	// the longer side of the pixel's footprint in texels picks the level
+	double w = width(), h = height();
+	double lx = dx.x * dx.x * w * w + dx.y * dx.y * h * h;
+	double ly = dy.x * dy.x * w * w + dy.y * dy.y * h * h;
+	double lod = 0.5 * std::log2(std::max(std::max(lx, ly), 1e-12));
+	lod = std::clamp(lod, 0.0, double(levels() - 1));
+
+	int   lo = lod;
+	float t  = lod - lo;
+	color_t c = bilinear(lo, uv);
+	if (t > 0 && lo + 1 < levels())
+		c = c * (1 - t) + bilinear(lo + 1, uv) * t;
+	return c;
+}
+
+color_t Texture::bilinear(int lod, const vec2 &uv) const {
+	const TexLevel& level = mips[lod];
+	int lw = level.width(), lh = level.height();
+	double x = uv.x * lw - 0.5, y = uv.y * lh - 0.5;
+	int x0 = std::floor(x), y0 = std::floor(y);
+	float fx = x - x0, fy = y - y0;
+	// clamp to the edge texels
+	int x1 = std::min(x0 + 1, lw - 1), y1 = std::min(y0 + 1, lh - 1);
+	x0 = std::max(x0, 0);
+	y0 = std::max(y0, 0);
+	color_t bottom = level.get(x0, y0) * (1 - fx) + level.get(x1, y0) * fx;
+	color_t top    = level.get(x0, y1) * (1 - fx) + level.get(x1, y1) * fx;
+	return bottom * (1 - fy) + top * fy;
+}
+
+void Texture::gen_mipmaps() {
+	mips.clear();
+	if (!image.width() || !image.height())
+		return;
+	mips.emplace_back(image);
+	while (mips.back().width() > 1 || mips.back().height() > 1)
+		mips.push_back(mips.back().half());
+}
@@ -1,14 +1,65 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <cstdint>
 #include "global.h"
 #include "geometry.h"
 #include "tgaimage.h"
 
+/**
+ * texels of one mip level as packed BGRA bytes, ordered in TEXTURE_TILE x TEXTURE_TILE
+ * tiles, row by row inside a tile. a bilinear footprint or a small neighbourhood
+ * walked in any direction stays in one or two cache lines, where the rows of a
+ * TGAImage are a whole image row apart.
+ */
+const int TEXTURE_TILE = 4;
+
+// n / 255 for every byte n, the conversion of a texel channel to float
+extern const float UNORM8[256];
+
+class TexLevel {
+public:
+	TexLevel() = default;
+	TexLevel(int width, int height);
+	// decode the BGR(A) or grayscale bytes of an image, grayscale goes to b like TGAImage::get
+	explicit TexLevel(const TGAImage& image);
+	// texel (x, y) from a single load, transparent black outside the level like TGAImage::get
+	color_t get(int x, int y) const {
+		if (x < 0 || x >= w || y < 0 || y >= h)
+			return {};
+		std::uint32_t t = texels[index(x, y)];
+		color_t ret;
+		ret.b = UNORM8[t & 0xff];
+		ret.g = UNORM8[t >> 8 & 0xff];
+		ret.r = UNORM8[t >> 16 & 0xff];
+		ret.a = UNORM8[t >> 24];
+		return ret;
+	}
+	int width()  const { return w; }
+	int height() const { return h; }
+	// the next level, every texel the average of a 2x2 block
+	TexLevel half() const;
+private:
+	size_t index(int x, int y) const {
+		int t = (y / TEXTURE_TILE) * tw + x / TEXTURE_TILE;
+		return size_t(t) * TEXTURE_TILE * TEXTURE_TILE + (y % TEXTURE_TILE) * TEXTURE_TILE + x % TEXTURE_TILE;
+	}
+
+	int w  = 0;
+	int h  = 0;
+	int tw = 0;		// tiles per row
+	std::vector<std::uint32_t> texels{};	// bgra bytes in memory order
+};
+
+/**
+ * a texture and its mip chain, level i + 1 is level i halved by a 2x2 box filter
+ * down to 1x1. the chain is rebuilt whenever the image changes.
+ */
 class Texture {
 public:
 	Texture() = default;
-	Texture(TGAImage& image) : image(image) {}
-	Texture(TGAImage&& image) : image(image) {}
+	Texture(TGAImage& image) : image(image) { gen_mipmaps(); }
+	Texture(TGAImage&& image) : image(image) { gen_mipmaps(); }
 	Texture(const std::string& path) {
 		if (!image.read_tga_file(path)) {
 			std::cerr << "load " + path + "failed" << std::endl;
@@ -16,16 +67,35 @@ public:
 		else {
 			image.flip_vertically();
 		}
+		gen_mipmaps();
 	}
-	int width() { return image.width(); };
-	int height() { return image.height(); };
-	color_t sample(const vec2& uv);
-	template<int nrows, int ncols> void convolute(const mat<nrows, ncols>& m);
+	int width()  const { return image.width(); };
+	int height() const { return image.height(); };
+	int levels() const { return mips.size(); }
+	// texel (x, y) of a level, without filtering
+	color_t fetch(int x, int y, int lod = 0) const { return mips.empty() ? color_t() : mips[lod].get(x, y); }
+	// nearest texel of level 0, for textures that must not be filtered like depth maps
+	color_t sample(const vec2& uv) const;
+	// nearest sample of n uvs at once, e.g. all the taps of a PCF kernel
+	void sample(const vec2* uv, int n, color_t* out) const;
+	/**
+	 * @brief trilinear sample, the level of detail comes from the uv footprint of a pixel
+	 * 
+	 * @param dx the change of uv to the next pixel in x, e.g. varying_uv * bar_ddx
+	 * @param dy the change of uv to the next pixel in y
+	 */
+	color_t sample(const vec2& uv, const vec2& dx, const vec2& dy) const;
+	template<int nrows, int ncols> void convolute(const mat<nrows, ncols>& m, EdgeMode edge = EDGE_KEEP);
 private:
-	TGAImage image;
+	void gen_mipmaps();
+	color_t bilinear(int lod, const vec2& uv) const;
+
+	TGAImage image;					// level 0 as loaded, the source of the mip chain
+	std::vector<TexLevel> mips{};	// level 0 and up
 };
 
 template <int nrows, int ncols>
-inline void Texture::convolute(const mat<nrows, ncols> &m) {
-	image = image.convolute(m);
+inline void Texture::convolute(const mat<nrows, ncols> &m, EdgeMode edge) {
+	image = image.convolute(m, edge);
+	gen_mipmaps();
 }
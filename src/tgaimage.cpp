@@ -160,6 +160,18 @@ int TGAImage::height() const {
 	return h;
 }
 
+int TGAImage::bytespp() const {
+	return bpp;
+}
+
+const std::uint8_t* TGAImage::buffer() const {
+	return data.empty() ? nullptr : data.data();
+}
+
+std::uint8_t* TGAImage::buffer() {
+	return data.empty() ? nullptr : data.data();
+}
+
 void TGAImage::clear() {
 	for (auto& i: data)
 		i = 0;
@@ -7,6 +7,7 @@
 #include "global.h"
 #include "color.h"
 #include "geometry.h"
+#include "filter.h"
 
 #pragma pack(push, 1)
 struct TGAHeader
@@ -70,10 +71,14 @@ public:
 	void flip_vertically();
 	color_t get(const int x, const int y) const;
 	void 	set(const int x, const int y, const color_t& c);
-	// nrows and ncols should be odd number
-	template<int nrows, int ncols> TGAImage convolute(const mat<nrows, ncols>& m);
+	// m[j][i] weights the pixel (x + i - ncols / 2, y + j - nrows / 2), nrows and ncols should be odd number
+	template<int nrows, int ncols> TGAImage convolute(const mat<nrows, ncols>& m, EdgeMode edge = EDGE_KEEP) const;
 	int width() const;
 	int height() const; 
+	int bytespp() const;
+	// the raw pixels, row by row, bytespp() bytes each
+	const std::uint8_t* buffer() const;
+	std::uint8_t* buffer();
 	void clear();
 private:
 	bool   load_rle_data(std::ifstream& in);
@@ -86,32 +91,10 @@ private:
 };
 
 template <int nrows, int ncols>
-inline TGAImage TGAImage::convolute(const mat<nrows, ncols> &m) {
-	int left   = ncols / 2, right = w - ncols + 1;
-	int bottom = nrows / 2, top = h - nrows + 1;
-
-	auto in_box = [&](int x, int y) -> bool {
-		return x>=left && x<=right && y>=bottom && y<=top;
-	};
-
-	TGAImage ret(w, h, bpp);
-
-	vec2 center(ncols / 2, nrows / 2);
-	for (int x = 0; x < w; ++x) {
-		for (int y = 0; y < h; ++y) {
-			if (!in_box(x, y))
-				ret.set(x, y, this->get(x, y));
-			else {
-				color_t tmp(0, 0, 0, 0);
-				for (int i = 0; i < ncols; ++i) {
-					for (int j = 0; j < nrows; ++j) {
-						vec2 pos(x + i - center.x, y + j - center.y);
-						tmp = tmp + this->get(pos.x, pos.y) * m[i][j];
-					}
-				}
-				ret.set(x, y, tmp);
-			}
-		}
-	}
-	return ret;
+inline TGAImage TGAImage::convolute(const mat<nrows, ncols> &m, EdgeMode edge) const {
+	float kernel[nrows * ncols];
+	for (int j = 0; j < nrows; ++j)
+		for (int i = 0; i < ncols; ++i)
+			kernel[j * ncols + i] = m[j][i];
+	return convolve(*this, kernel, ncols, nrows, edge);
 }
@@ -1,8 +1,142 @@
-#include <functional>
 #include "triangle.h"
 
+const vector<vec2>& sample_offsets(int sample_num) {
+	static const vector<vec2> center = { {0.5, 0.5} };
+	// 2 * 2 RGSS
+	static const vector<vec2> msaa4  = { {0.375, 0.125}, {0.875, 0.375}, {0.625, 0.875}, {0.125, 0.625} };
+	static const vector<vec2> msaa8  = {
+		{0.375, 0.125}, {0.875, 0.375}, {0.625, 0.875}, {0.125, 0.625},
+		{0.125, 0.875}, {0.375, 0.625}, {0.625, 0.375}, {0.875, 0.125}
+	};
+	static const vector<vec2> msaa16 = {
+		{0.125, 0.125}, {0.375, 0.125}, {0.625, 0.125}, {0.875, 0.125},
+		{0.125, 0.375}, {0.375, 0.375}, {0.625, 0.375}, {0.875, 0.375},
+		{0.125, 0.625}, {0.375, 0.625}, {0.625, 0.625}, {0.875, 0.625},
+		{0.125, 0.875}, {0.375, 0.875}, {0.625, 0.875}, {0.875, 0.875},
+	};
+	if (sample_num == 4)
+		return msaa4;
+	else if (sample_num == 8)
+		return msaa8;
+	else if (sample_num == 16)
+		return msaa16;
+	return center;
+}
+
 void Triangle::draw(IShader &shader, const mat4 &vp, DepthBuffer &zbuf, 
 					ColorBuffer* color_buf, AA_Format aa_f) {
+	Triangle parts[MAX_CLIP_PARTS];
+	int n = clip(vp, parts);
+	for (int i = 0; i < n; ++i)
+		parts[i].raster(shader, zbuf, color_buf, aa_f, BBox{0, 0, zbuf.width() - 1, zbuf.height() - 1});
+}
+
+int Triangle::clip(const mat4 &vp, Triangle *out) const {
+	/**
+	 * the visible side of a plane depends on the sign of w in front of the camera,
+	 * negative for perspective() and positive for orthographic(). only a perspective
+	 * triangle can have w of both signs. a perspective triangle with all w > 0 is
+	 * behind the camera, then every vertex is beyond the far plane and it's rejected.
+	 */
+	double s = visible_sign();
+	// guard band in ndc
+	double gx0 = (-GUARD_BAND - vp[0][3]) / vp[0][0];
+	double gx1 = ( GUARD_BAND - vp[0][3]) / vp[0][0];
+	double gy0 = (-GUARD_BAND - vp[1][3]) / vp[1][1];
+	double gy1 = ( GUARD_BAND - vp[1][3]) / vp[1][1];
+	if (gx0 > gx1) std::swap(gx0, gx1);
+	if (gy0 > gy1) std::swap(gy0, gy1);
+	enum { NEAR, LEFT, RIGHT, BOTTOM, TOP, FAR };
+	// signed distance to a plane, inside if >= 0
+	auto dist = [&](const vec4& v, int plane) -> double {
+		switch (plane) {
+			case NEAR:   return s * (v.w - v.z);
+			case LEFT:   return s * (v.x - gx0 * v.w);
+			case RIGHT:  return s * (gx1 * v.w - v.x);
+			case BOTTOM: return s * (v.y - gy0 * v.w);
+			case TOP:    return s * (gy1 * v.w - v.y);
+			default:     return s * (v.z + v.w);
+		}
+	};
+
+	// the guard band outcodes are only meaningful in front of the camera,
+	// so only the near and the far plane can reject the whole triangle
+	uint32_t any = 0, all = ~0u;
+	for (int i = 0; i < 3; ++i) {
+		uint32_t code = 0;
+		for (int k = NEAR; k <= FAR; ++k)
+			code |= (dist(verts[i], k) < 0) << k;
+		any |= code;
+		all &= code;
+	}
+	if (all & (1 << NEAR | 1 << FAR))
+		return 0;
+	if (!(any & ~(1 << FAR))) {		// the far plane is left to the depth test
+		out[0] = *this;
+		out[0].setup(vp);
+		return out[0].degenerate ? 0 : 1;
+	}
+
+	// Sutherland-Hodgman, the vertexs carry their barycentric coordinates
+	struct ClipVert {
+		vec4 p;
+		vec3 bar;
+	};
+	ClipVert poly[2][3 + FAR];
+	int n = 3;
+	for (int i = 0; i < 3; ++i) {
+		poly[0][i].p = verts[i];
+		poly[0][i].bar = vec3(i == 0, i == 1, i == 2);
+	}
+	int cur = 0;
+	for (int k = NEAR; k < FAR; ++k) {
+		const ClipVert* in = poly[cur];
+		ClipVert* o = poly[cur ^ 1];
+		double d[3 + FAR];
+		bool outside = false;
+		for (int i = 0; i < n; ++i) {
+			d[i] = dist(in[i].p, k);
+			outside = outside || d[i] < 0;
+		}
+		if (!outside)
+			continue;
+		int m = 0;
+		for (int i = 0; i < n; ++i) {
+			int j = (i + 1) % n;
+			if (d[i] >= 0)
+				o[m++] = in[i];
+			if ((d[i] >= 0) != (d[j] >= 0)) {
+				double t = d[i] / (d[i] - d[j]);
+				o[m].p   = in[i].p   + (in[j].p   - in[i].p)   * t;
+				o[m].bar = in[i].bar + (in[j].bar - in[i].bar) * t;
+				++m;
+			}
+		}
+		n = m;
+		cur ^= 1;
+		if (n < 3)
+			return 0;
+	}
+
+	// fan of the polygon
+	const ClipVert* v = poly[cur];
+	int cnt = 0;
+	for (int i = 1; i + 1 < n; ++i) {
+		Triangle& t = out[cnt];
+		t = Triangle(v[0].p, v[i].p, v[i + 1].p);
+		t.state    = state;
+		t.clipped  = true;
+		t.bar_remap.set_col(0, v[0].bar);
+		t.bar_remap.set_col(1, v[i].bar);
+		t.bar_remap.set_col(2, v[i + 1].bar);
+		t.setup(vp);
+		if (!t.degenerate)
+			++cnt;
+	}
+	return cnt;
+}
+
+void Triangle::setup(const mat4 &vp) {
 	for (int i = 0; i < 3; ++i) {
 		scoord[i] = vp * verts[i];
 		scoord[i] = scoord[i] / scoord[i][3];	
@@ -13,160 +147,157 @@ void Triangle::draw(IShader &shader, const mat4 &vp, DepthBuffer &zbuf,
 		verts[i].w = t;
 	}
 
-	int bbox_left   = std::min(scoord[0].x, std::min(scoord[1].x, scoord[2].x));
-	int bbox_right  = std::max(scoord[0].x, std::max(scoord[1].x, scoord[2].x));
-	int bbox_bottom = std::min(scoord[0].y, std::min(scoord[1].y, scoord[2].y));
-	int bbox_top    = std::max(scoord[0].y, std::max(scoord[1].y, scoord[2].y));
-	bbox_left   = std::max(0, bbox_left);
-	bbox_right  = std::min(zbuf.width()  - 1, bbox_right);
-	bbox_bottom = std::max(0, bbox_bottom);
-	bbox_top    = std::min(zbuf.height() - 1, bbox_top);
-
-	using std::placeholders::_1;
-	using std::placeholders::_2;
-	using std::placeholders::_3;
-	using Sampler = pack_t(int, int, IShader&);
-	std::function<Sampler> simpler;
-	if (aa_f == AA_Format::NOAA) {
-		assert(zbuf.simple_num() == 1);
-		simpler = std::bind(&Triangle::noaa, this, _1, _2, 1, _3);
+	// snap the vertexs to the sub-pixel grid
+	int64_t X[3], Y[3];
+	for (int i = 0; i < 3; ++i) {
+		// also rejects nan, vertexs that far away need clipping
+		if (!(std::abs(scoord[i].x) < SUBPIXEL_LIMIT && std::abs(scoord[i].y) < SUBPIXEL_LIMIT)) {
+			reject();
+			return;
+		}
+		X[i] = std::llround(scoord[i].x * SUBPIXEL);
+		Y[i] = std::llround(scoord[i].y * SUBPIXEL);
 	}
-	else {
-		assert(zbuf.simple_num() == aa_f);
-		simpler = std::bind(&Triangle::msaa, this, _1, _2, aa_f, _3);
+	area2 = (X[1] - X[0]) * (Y[2] - Y[0]) - (X[2] - X[0]) * (Y[1] - Y[0]);
+	if (area2 == 0) {	// zero area triangle covers no sample
+		reject();
+		return;
 	}
 
-	pack_t pack;
-	for (int x = bbox_left; x <= bbox_right; ++x) {
-		for (int y = bbox_bottom; y <= bbox_top; ++y) {
-			pack = simpler(x, y, shader);
-			for (int i = 0; i < pack.size(); ++i) {
-				int   idx = std::get<0>(pack[i]);
-				depth_t d = std::get<1>(pack[i]);
-				if (d >= -1.0 && d <= 1.0 && d > zbuf.get(x, y, idx)) {
-					zbuf.set(x, y, idx, d);		// pass depth test, write depth
-
-					std::optional<color_t> c = std::get<2>(pack[i]);
-					if (!c.has_value())
-						continue;
-					color_t color = c.value();
-					if (color_buf && gl_blend) {
-						color_t tmp = color_buf->get(x, y, idx);
-						float alpha = color.a;
-						color = (color * alpha) + (tmp * (1 - alpha));
-					}
-					if (color_buf && color[3] != 0)	// if alpha == 0, ignore it
-						color_buf->set(x, y, idx, color);
-				}
-			}
-		}
+	// E_k(x, y) = a*x + b*y + c is the edge opposite to vertex k, scaled so
+	// that E_k(vertex k) == area2 > 0 whatever the winding is
+	int64_t sign = area2 > 0 ? 1 : -1;
+	area2 *= sign;
+	for (int k = 0; k < 3; ++k) {
+		int i = (k + 1) % 3;
+		int j = (k + 2) % 3;
+		edge_a[k] = (Y[i] - Y[j]) * sign;
+		edge_b[k] = (X[j] - X[i]) * sign;
+		edge_c[k] = (X[i] * Y[j] - X[j] * Y[i]) * sign;
+		// top-left fill rule, samples exactly on a right or bottom edge
+		// belong to the neighbour triangle
+		bool top_left = edge_a[k] > 0 || (edge_a[k] == 0 && edge_b[k] < 0);
+		if (!top_left)
+			edge_c[k] -= 1;
 	}
-}
 
-void Triangle::enable(const uint32_t & feature) {
-	if (feature & GL_BLEND)
-		gl_blend = true;
+	// depth plane in pixel units, relative to the lower left corner of the bounding box
+	double z_a = 0, z_b = 0, z_c = 0;
+	for (int k = 0; k < 3; ++k) {
+		z_a += verts[k].z * edge_a[k];
+		z_b += verts[k].z * edge_b[k];
+		z_c += verts[k].z * edge_c[k];
+	}
+	auto floor_px = [](int64_t v) -> int {
+		return v >= 0 ? v / SUBPIXEL : -((-v + SUBPIXEL - 1) / SUBPIXEL);
+	};
+	box.left   = floor_px(std::min(X[0], std::min(X[1], X[2])));
+	box.right  = floor_px(std::max(X[0], std::max(X[1], X[2])));
+	box.bottom = floor_px(std::min(Y[0], std::min(Y[1], Y[2])));
+	box.top    = floor_px(std::max(Y[0], std::max(Y[1], Y[2])));
+
+	xref = box.left;
+	yref = box.bottom;
+	dzdx = z_a * SUBPIXEL / area2;
+	dzdy = z_b * SUBPIXEL / area2;
+	zref = (z_a * xref * SUBPIXEL + z_b * yref * SUBPIXEL + z_c) / area2;
+	zmax = std::max(verts[0].z, std::max(verts[1].z, verts[2].z));
 }
 
-vec3 Triangle::baryentric(const vec2 &p) {
-	vec3 t1 = vec3(scoord[1][0] - scoord[0][0], scoord[2][0] - scoord[0][0], scoord[0][0] - p[0]);
-	vec3 t2 = vec3(scoord[1][1] - scoord[0][1], scoord[2][1] - scoord[0][1], scoord[0][1] - p[1]);
-	vec3 t = cross(t1, t2);
-	if (std::abs(t.z) < 1e-3) {
-		return vec3(-1, 1, 1);
-	}
-	float u = t.x / t.z;
-	float v = t.y / t.z;
-	return vec3(1 - u - v, u, v);
+void Triangle::raster(IShader &shader, DepthBuffer &zbuf, ColorBuffer *color_buf, 
+					  AA_Format aa_f, const BBox &clip) const {
+	dispatch_aa(aa_f, [&](auto aa) {
+		raster<IShader, decltype(aa)::value>(shader, zbuf, color_buf, clip);
+	});
 }
 
-void Triangle::bar_corrent(vec3 &bar, double w) {
-	bar = 1.0 / w * vec3(verts[0].w, verts[1].w, verts[2].w) * bar;
+void Triangle::raster(DepthBuffer &zbuf, AA_Format aa_f, const BBox &clip) const {
+	auto none = [](int, int, const int64_t*, uint32_t, const Samples&) {};
+	dispatch_aa(aa_f, [&](auto aa) { walk<decltype(aa)::value>(zbuf, clip, none); });
 }
 
-pack_t Triangle::noaa(int x, int y, int sample_num, IShader &shader) {
-	pack_t ret;
-	vec3 bar  = baryentric(vec2(x + 0.5, y + 0.5));
-	if (bar.x < 0 || bar.y < 0 || bar.z < 0)
-		return ret;
-	depth_t d = dot(vec3(verts[0].z, verts[1].z, verts[2].z), bar);
-	double  w = dot(vec3(verts[0].w, verts[1].w, verts[2].w), bar);
-
-	bar_corrent(bar, w);
-	// color_t color;
-	std::optional<color_t> color(shader.fragment(bar));
-	ret.push_back(std::make_tuple(0, d, color));
-	return ret;
+void Triangle::raster(IdBuffer &id_buf, VisId id, DepthBuffer &zbuf, 
+					  AA_Format aa_f, const BBox &clip) const {
+	assert(id_buf.simple_num() == zbuf.simple_num());
+	auto write = [&](int x0, int y, const int64_t*, uint32_t, const Samples& samples) {
+		for (int i = 0; i < samples.num; ++i) {
+			if (!samples.passed[i])
+				continue;
+			VisId* row = id_buf.address(x0, y, i);
+			for (int lane = 0; lane < KERNEL_WIDTH; ++lane)
+				if (samples.passed[i] >> lane & 1)
+					row[lane] = id;
+		}
+	};
+	dispatch_aa(aa_f, [&](auto aa) { walk<decltype(aa)::value>(zbuf, clip, write); });
 }
 
-pack_t Triangle::msaa(int x, int y, int sample_num, IShader &shader) {
-	vector<vec2> offsets;
-	if (sample_num == 4) {
-		// 2 * 2 RGSS
-		offsets = { {0.375, 0.125}, {0.875, 0.375}, {0.625, 0.875}, {0.125, 0.625} };
-	}
-	else if (sample_num == 8) {
-		offsets = {
-			{0.375, 0.125}, {0.875, 0.375}, {0.625, 0.875}, {0.125, 0.625},
-			{0.125, 0.875}, {0.375, 0.625}, {0.625, 0.375}, {0.875, 0.125}
-		};
-	}
-	else if (sample_num == 16) {
-		offsets = {
-			{0.125, 0.125}, {0.375, 0.125}, {0.625, 0.125}, {0.875, 0.125},
-			{0.125, 0.375}, {0.375, 0.375}, {0.625, 0.375}, {0.875, 0.375},
-			{0.125, 0.625}, {0.375, 0.625}, {0.625, 0.625}, {0.875, 0.625},
-			{0.125, 0.875}, {0.375, 0.875}, {0.625, 0.875}, {0.875, 0.875},
-		};
+vec3 Triangle::barycentric(const vec4 pts[3], const mat4 &vp, const vec2 &p) {
+	// the weights b with sum(b_k * (screen_k - p) * w_k) == 0, in homogeneous coordinates
+	vec3 u, v;
+	for (int k = 0; k < 3; ++k) {
+		vec4 q = vp * pts[k];
+		u[k] = q.x - p.x * q.w;
+		v[k] = q.y - p.y * q.w;
 	}
+	vec3 bar = cross(u, v);
+	return bar / (bar.x + bar.y + bar.z);
+}
 
-	pack_t ret;
-	vector<int> tmp;
-	vec2 target(0, 0);
-	vec3 bar;
-	for (int i = 0; i < sample_num; ++i) {
-		vec2 t(x + offsets[i].x, y + offsets[i].y);
-		bar = baryentric(t);
-		if (bar.x>=0.0 && bar.y>=0.0 && bar.z>=0.0) {
-			tmp.push_back(i);
-			target = target + t;
-		}
+float Triangle::nearest(int bx, int by) const {
+	// the plane is largest at one of the block's corners
+	double x = bx - xref + (dzdx > 0 ? BUFFER_TILE : 0);
+	double y = by - yref + (dzdy > 0 ? BUFFER_TILE : 0);
+	double z = zref + dzdx * x + dzdy * y;
+	// leave a margin for the rounding of the kernel's float plane
+	return std::min<double>(z, zmax) + 1e-5;
+}
+
+bool Triangle::occluded(DepthBuffer &zbuf, int bx, int by) const {
+	// the depth buffer's farthest depth of the block is a lower bound of all its samples
+	switch (state.depth_func) {
+		case DEPTH_GREATER: return nearest(bx, by) <= zbuf.farthest(bx, by);
+		case DEPTH_GEQUAL:
+		case DEPTH_EQUAL:   return nearest(bx, by) <  zbuf.farthest(bx, by);
+		default:            return false;
 	}
-	if (tmp.empty())
-		return ret;
-	target = target / tmp.size();
-	bar = baryentric(target);
-	depth_t d = dot(vec3(verts[0].z, verts[1].z, verts[2].z), bar);
-	double w  = dot(vec3(verts[0].w, verts[1].w, verts[2].w), bar);
-
-	bar_corrent(bar, w);
-	std::optional<color_t> color(shader.fragment(bar));
-
-	for (int idx: tmp) {
-		ret.push_back(std::make_tuple(idx, d, color));
+}
+
+bool Triangle::outside() const {
+	double s = visible_sign();
+	uint32_t all = ~0u;
+	for (int i = 0; i < 3; ++i) {
+		const vec4& v = verts[i];
+		uint32_t code = 0;
+		code |= (s * (v.w + v.x) < 0) << 0;
+		code |= (s * (v.w - v.x) < 0) << 1;
+		code |= (s * (v.w + v.y) < 0) << 2;
+		code |= (s * (v.w - v.y) < 0) << 3;
+		code |= (s * (v.w + v.z) < 0) << 4;		// far
+		code |= (s * (v.w - v.z) < 0) << 5;		// near
+		all &= code;
 	}
-	return ret;
+	return all != 0;
+}
+
+bool Triangle::cull(CullMode mode) const {
+	if (mode == CULL_NONE)
+		return false;
+	// the sign of the area on screen, without dividing by w. 
+	// it is the side of the face the camera is on, so also right for faces crossing the near plane
+	mat3 m;
+	for (int i = 0; i < 3; ++i)
+		m[i] = vec3(verts[i].x, verts[i].y, verts[i].w);
+	bool front = m.det() * visible_sign() > 0;
+	return mode == CULL_BACK ? !front : front;
 }
 
-// vector<tuple<int, depth_t, color_t>>
-// pack_t Triangle::ssaa(int x, int y, int sample_num, IShader &shader) {
-// 	vector<vec2> offsets;
-// 	if (sample_num == 4) {
-// 		offsets = { {0.25, 0.25}, {0.75, 0.25}, {0.25, 0.75}, {0.75, 0.75} };
-// 	}
-
-// 	pack_t ret;
-// 	vec3 bar;
-// 	color_t color;
-// 	for (int i = 0; i < sample_num; ++i) {
-// 		bar = baryentric(vec2(x + offsets[i].x, y + offsets[i].y));
-// 		if (bar.x>=0.0 && bar.y>=0.0 && bar.z>=0.0) {
-// 			depth_t d = dot(vec3(verts[0].z, verts[1].z, verts[2].z), bar);
-// 			double  w = dot(vec3(verts[0].w, verts[1].w, verts[2].w), bar);
-// 			bar_corrent(bar, w);
-// 			std::optional<color_t> color(shader.fragment(bar));
-// 			ret.push_back(std::make_tuple(i, d, color));
-// 		}
-// 	}
-// 	return ret;
-// }
+void Triangle::enable(const uint32_t & feature) {
+	if (feature & GL_BLEND)
+		state.blend = true;
+}
+
+void Triangle::reject() {
+	degenerate = true;
+	box = BBox{0, 0, -1, -1};
+}
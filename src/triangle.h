@@ -1,23 +1,73 @@
 #pragma once
+#include <cstdint>
 #include <vector>
-#include <utility>
-#include <tuple>
 #include "tgaimage.h"
 #include "geometry.h"
 #include "gl.h"
+#include "kernel.h"
 
 using std::vector;
-using std::tuple;
 
-using pack_t = vector<tuple<int, depth_t, std::optional<color_t>>>;
+// vertexs are snapped to 1/SUBPIXEL of a pixel
+const int SUBPIXEL_BITS = 8;
+const int SUBPIXEL = 1 << SUBPIXEL_BITS;
+// larger screen coordinates overflow the 64 bit edge equations
+const double SUBPIXEL_LIMIT = 1 << 20;
+// triangles reaching beyond the guard band are clipped to it, the rest
+// only gets clipped by the raster's bounding box
+const double GUARD_BAND = SUBPIXEL_LIMIT / 2;
+
+// sample positions inside a pixel for a sample count, all on the sub-pixel grid
+const vector<vec2>& sample_offsets(int sample_num);
+
+// screen space rectangle, bounds are inclusive
+struct BBox {
+	int left, bottom, right, top;
+};
 
 class Triangle
 {
 public:
 	enum AA_Format { NOAA = 1, MSAA4 = 4, MSAA8 = 8, MSAA16 = 16 };
+	// a triangle clipped by the near plane and the 4 guard band planes is a fan of at most 6
+	static const int MAX_CLIP_PARTS = 6;
 	void draw(IShader& shader, const mat4 & vp, DepthBuffer& zbuf, 
 			  ColorBuffer* color_buf, AA_Format aa_f = AA_Format::NOAA);
+	// project the vertexs to screen space, must be called once before raster()
+	void setup(const mat4& vp);
+	/**
+	 * @brief clip against the near plane, and the guard band if needed, in clip space
+	 * 
+	 * @param out set up triangles covering the visible part, at most MAX_CLIP_PARTS.
+	 * 		the fragment shader still gets barycentric coordinates of this triangle
+	 * @return the number of triangles in out
+	 */
+	int  clip(const mat4& vp, Triangle* out) const;
+	// before clip(), true if all the vertexs are outside of one plane of the view frustum
+	bool outside() const;
+	// before clip(), true if the winding on screen is culled by mode
+	bool cull(CullMode mode) const;
+	// rasterize the part of the triangle inside clip, the shader must hold this triangle's varyings
+	void raster(IShader& shader, DepthBuffer& zbuf, ColorBuffer* color_buf, 
+				AA_Format aa_f, const BBox& clip) const;
+	// same with the shader type and the sample count known at compile time
+	template<typename ShaderT, AA_Format AA>
+	void raster(ShaderT& shader, DepthBuffer& zbuf, ColorBuffer* color_buf, const BBox& clip) const;
+	// depth only, no interpolation and no fragment shader. what the above does
+	// without a color buffer, unless the shader has late_z
+	void raster(DepthBuffer& zbuf, AA_Format aa_f, const BBox& clip) const;
+	// rasterize without shading, the samples that pass the depth test get id
+	void raster(IdBuffer& id_buf, VisId id, DepthBuffer& zbuf, 
+				AA_Format aa_f, const BBox& clip) const;
+	// perspective correct barycentric coordinates of screen point p in the
+	// clip space triangle pts, whichever side of the camera its vertexs are
+	static vec3 barycentric(const vec4 pts[3], const mat4& vp, const vec2& p);
+	// screen space bounding box, not clamped to the viewport
+	const BBox& bbox() const { return box; }
 	void enable(const uint32_t& feature);
+	// depth test, depth and color writes and blending of the raster, cull is left to the caller
+	void set_state(const RenderState& s) { state = s; }
+	const RenderState& render_state() const { return state; }
 	Triangle() = default;
 	Triangle(vec4 pts[3]) { for (int i = 3; i--; verts[i] = pts[i]); }
 	Triangle(vec4 A, vec4 B, vec4 C) {
@@ -27,15 +77,230 @@ public:
 	}
 	~Triangle() = default;
 private:
-	vec3 baryentric(const vec2& p);
-	void bar_corrent(vec3& bar, double w);
-	bool gl_blend = false;
-	// vector<pair<int, TGAColor>> msaa(int x, int y, int sample_num, IShader& shader);
-	// vector<pair<int, TGAColor>> ssaa(int x, int y, int sample_num, IShader& shader);
-	pack_t noaa(int x, int y, int sample_num, IShader& shader);
-	pack_t msaa(int x, int y, int sample_num, IShader& shader);
-	// pack_t ssaa(int x, int y, int sample_num, IShader& shader);
+	// per raster() sample pattern, and the kernel results of the current span
+	struct Samples {
+		int num;
+		int64_t  edge[16][3];	// edge values relative to the pixel's corner
+		float    x[16];
+		float    y[16];
+		uint32_t covered[16];	// lane masks
+		uint32_t passed[16];
+	};
+
+	// run the coverage and depth kernel over the part inside clip, visit(x0, y, e, any, samples)
+	// for every span with a sample passing the depth test, any is the lanes holding one.
+	// without write_depth the passing samples are left for the visitor to write
+	template<AA_Format AA, typename Visit>
+	void walk(DepthBuffer& zbuf, const BBox& clip, Visit visit, bool write_depth = true) const;
+	void reject();
+	// sign of the clip space w of visible points, see clip()
+	double visible_sign() const {
+		return (verts[0].w > 0 && verts[1].w > 0 && verts[2].w > 0) ? 1 : -1;
+	}
+	// upper bound of the triangle's depth inside the block at (bx, by)
+	float nearest(int bx, int by) const;
+	// true if no sample of the block at (bx, by) can pass the depth test
+	bool  occluded(DepthBuffer& zbuf, int bx, int by) const;
+	void bar_corrent(vec3& bar, double w) const {
+		bar = 1.0 / w * vec3(verts[0].w, verts[1].w, verts[2].w) * bar;
+		if (clipped)
+			bar = bar_remap * bar;
+	}
+	// screen space bar to the perspective-correct bar of the original triangle
+	vec3 perspective_bar(vec3 bar) const {
+		bar_corrent(bar, dot(vec3(verts[0].w, verts[1].w, verts[2].w), bar));
+		return bar;
+	}
+	// run the fragment shader for the lanes any of a span, e is the edge values of its first pixel.
+	// the depth of the passing samples goes to zbuf here if the shader has late_z
+	template<AA_Format AA, typename ShaderT>
+	void shade(int x0, int y, const int64_t* e, uint32_t any, const Samples& samples, 
+			   ShaderT& shader, DepthBuffer& zbuf, ColorBuffer* color_buf) const;
+	RenderState state{};
 
 	vec4 verts[3];	// vertexs of triangle in clip space
 	vec4 scoord[3];	// vertex of triangle in screen space
-};
\ No newline at end of file
+	BBox box;
+	// a part made by clip(), column k is vertex k's barycentric coordinates in the unclipped triangle
+	bool clipped = false;
+	mat3 bar_remap;
+
+	// edge equations in sub-pixel units, a sample is inside if all are >= 0
+	int64_t edge_a[3];
+	int64_t edge_b[3];
+	int64_t edge_c[3];
+	int64_t area2 = 0;			// twice the area in sub-pixel units
+	bool degenerate = false;
+
+	// depth plane, depth(x, y) = zref + dzdx * (x - xref) + dzdy * (y - yref)
+	int   xref = 0;
+	int   yref = 0;
+	float zref = 0;
+	float dzdx = 0;
+	float dzdy = 0;
+	float zmax = 0;		// nearest vertex
+};
+
+// call f(std::integral_constant<Triangle::AA_Format, aa_f>()), to pick the instance of a template
+template<typename F> inline void dispatch_aa(Triangle::AA_Format aa_f, F f) {
+	switch (aa_f) {
+		case Triangle::MSAA4:  f(std::integral_constant<Triangle::AA_Format, Triangle::MSAA4>());  break;
+		case Triangle::MSAA8:  f(std::integral_constant<Triangle::AA_Format, Triangle::MSAA8>());  break;
+		case Triangle::MSAA16: f(std::integral_constant<Triangle::AA_Format, Triangle::MSAA16>()); break;
+		default:               f(std::integral_constant<Triangle::AA_Format, Triangle::NOAA>());   break;
+	}
+}
+
+template<typename ShaderT, Triangle::AA_Format AA>
+void Triangle::raster(ShaderT &shader, DepthBuffer &zbuf, ColorBuffer *color_buf, const BBox &clip) const {
+	if ((!color_buf || !state.color_mask) && !shader.late_z) {
+		walk<AA>(zbuf, clip, [](int, int, const int64_t*, uint32_t, const Samples&) {});
+		return;
+	}
+	walk<AA>(zbuf, clip, [&](int x0, int y, const int64_t* e, uint32_t any, const Samples& samples) {
+		shade<AA>(x0, y, e, any, samples, shader, zbuf, color_buf);
+	}, !shader.late_z);
+}
+
+template<Triangle::AA_Format AA, typename Visit>
+void Triangle::walk(DepthBuffer &zbuf, const BBox &clip, Visit visit, bool write_depth) const {
+	if (degenerate)
+		return;
+	int bbox_left   = std::max(clip.left,   box.left);
+	int bbox_right  = std::min(clip.right,  box.right);
+	int bbox_bottom = std::max(clip.bottom, box.bottom);
+	int bbox_top    = std::min(clip.top,    box.top);
+	if (bbox_left > bbox_right || bbox_bottom > bbox_top)
+		return;
+	assert(zbuf.simple_num() == AA);
+
+	// edge values and depth plane position of every sample relative to the pixel's corner
+	const vector<vec2>& offsets = sample_offsets(AA);
+	Samples samples;
+	samples.num = AA;
+	for (int i = 0; i < AA; ++i) {
+		int64_t ox = std::llround(offsets[i].x * SUBPIXEL);
+		int64_t oy = std::llround(offsets[i].y * SUBPIXEL);
+		for (int k = 0; k < 3; ++k)
+			samples.edge[i][k] = edge_a[k] * ox + edge_b[k] * oy;
+		samples.x[i] = offsets[i].x;
+		samples.y[i] = offsets[i].y;
+	}
+
+	// spans are aligned to the buffers' tile rows
+	static_assert(KERNEL_WIDTH == BUFFER_TILE, "a span must be a tile row");
+	depth_span_fn depth_span = depth_span_kernel();
+	int x_start = bbox_left - bbox_left % KERNEL_WIDTH;
+	int64_t step_x[3], step_y[3], e[3];
+	for (int k = 0; k < 3; ++k) {
+		step_x[k] = edge_a[k] * SUBPIXEL;
+		step_y[k] = edge_b[k] * SUBPIXEL;
+	}
+
+	// visit the bounding box a BUFFER_TILE block at a time, so whole blocks
+	// that are behind the depth buffer's farthest depth can be skipped
+	int y_start = bbox_bottom - bbox_bottom % BUFFER_TILE;
+	for (int by = y_start; by <= bbox_top; by += BUFFER_TILE) {
+		for (int bx = x_start; bx <= bbox_right; bx += BUFFER_TILE) {
+			if (occluded(zbuf, bx, by))
+				continue;
+
+			int lo = std::max(bbox_left - bx, 0);
+			int hi = std::min(bbox_right - bx, KERNEL_WIDTH - 1);
+			uint32_t lanes = ((2u << hi) - 1) & ~((1u << lo) - 1);
+
+			DepthSpan span;
+			for (int k = 0; k < 3; ++k)
+				span.step[k] = step_x[k];
+			span.dzdx  = dzdx;
+			span.lanes = lanes;
+			span.func  = state.depth_func;
+			span.write = write_depth && state.depth_write;
+			uint32_t written = 0;
+			int y_end = std::min(by + BUFFER_TILE - 1, bbox_top);
+			for (int y = std::max(by, bbox_bottom); y <= y_end; ++y) {
+				for (int k = 0; k < 3; ++k)
+					e[k] = step_x[k] * bx + step_y[k] * y + edge_c[k];
+				uint32_t any = 0;
+				for (int i = 0; i < AA; ++i) {
+					for (int k = 0; k < 3; ++k)
+						span.e[k] = e[k] + samples.edge[i][k];
+					span.z  = zref + dzdy * (float(y - yref) + samples.y[i]);
+					span.fx = float(bx - xref) + samples.x[i];
+					samples.covered[i] = depth_span(span, zbuf.address(bx, y, i), samples.passed[i]);
+					any |= samples.passed[i];
+				}
+				if (state.depth_write)
+					written |= any;
+				if (any)
+					visit(bx, y, e, any, samples);
+			}
+			if (written)
+				zbuf.update_block(bx, by);
+		}
+	}
+}
+
+template<Triangle::AA_Format AA, typename ShaderT>
+void Triangle::shade(int x0, int y, const int64_t *e, uint32_t any, const Samples& samples, 
+					 ShaderT &shader, DepthBuffer &zbuf, ColorBuffer *color_buf) const {
+	for (int lane = 0; lane < KERNEL_WIDTH; ++lane) {
+		if (!(any >> lane & 1))
+			continue;
+		// run the fragment shader once at the centroid of the covered samples
+		int cnt = 0;
+		vec3 target(0, 0, 0);	// sum of edge values of the covered samples
+		for (int i = 0; i < AA; ++i) {
+			if (!(samples.covered[i] >> lane & 1))
+				continue;
+			++cnt;
+			for (int k = 0; k < 3; ++k)
+				target[k] += e[k] + edge_a[k] * SUBPIXEL * lane + samples.edge[i][k];
+		}
+		vec3 lin = target / (double(area2) * cnt);
+		vec3 dx, dy;	// screen space bar to the next pixel in x and y
+		for (int k = 0; k < 3; ++k) {
+			dx[k] = double(edge_a[k] * SUBPIXEL) / area2;
+			dy[k] = double(edge_b[k] * SUBPIXEL) / area2;
+		}
+		// the derivatives are analytic differences to the neighbor pixels, not those of a 2x2
+		// quad: fragments run one at a time here, there are no helper lanes to difference with
+		vec3 bar = perspective_bar(lin);
+		shader.bar_ddx = perspective_bar(lin + dx) - bar;
+		shader.bar_ddy = perspective_bar(lin + dy) - bar;
+		std::optional<color_t> c(shader_fragment(shader, bar));
+		if (!c.has_value())
+			continue;
+
+		int x = x0 + lane;
+		if (shader.late_z && state.depth_write) {
+			// the same plane as the kernel's, the block is rescanned by walk()
+			for (int i = 0; i < AA; ++i) {
+				if (!(samples.passed[i] >> lane & 1))
+					continue;
+				float z = zref + dzdy * (float(y - yref) + samples.y[i]);
+				*zbuf.address(x, y, i) = z + dzdx * (float(x0 - xref) + samples.x[i] + lane);
+			}
+		}
+		if (!color_buf || !state.color_mask)
+			continue;
+		for (int i = 0; i < AA; ++i) {
+			if (!(samples.passed[i] >> lane & 1))
+				continue;
+			color_t color = c.value();
+			if (state.blend || state.color_mask != COLOR_RGBA) {
+				color_t tmp = color_buf->get(x, y, i);
+				if (state.blend) {
+					float alpha = color.a;
+					color = (color * alpha) + (tmp * (1 - alpha));
+				}
+				if (!(state.color_mask & COLOR_R)) color.r = tmp.r;
+				if (!(state.color_mask & COLOR_G)) color.g = tmp.g;
+				if (!(state.color_mask & COLOR_B)) color.b = tmp.b;
+				if (!(state.color_mask & COLOR_A)) color.a = tmp.a;
+			}
+			if (color[3] != 0)	// if alpha == 0, ignore it
+				color_buf->set(x, y, i, color);
+		}
+	}
+}
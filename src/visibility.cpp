@@ -0,0 +1,101 @@
+#include "visibility.h"
+
+VisibilityBuffer::VisibilityBuffer(int width, int height, Triangle::AA_Format aa_f)
+	: w(width), h(height), aa(aa_f)
+	, zbuf(width, height, -std::numeric_limits<float>::max(), aa_f)
+	, id_buf(width, height, VisId(), aa_f) { }
+
+void VisibilityBuffer::clear() {
+	zbuf.clear(-std::numeric_limits<float>::max());
+	id_buf.clear(VisId());
+	draws.clear();
+}
+
+void VisibilityBuffer::draw(Model &model, IShader &shader, const mat4 &vp) {
+	Draw d{&shader, shader.clone(), vp};
+	if (d.copy)
+		d.shader = d.copy.get();
+	int id = draws.size();
+	draws.push_back(std::move(d));
+	// the varyings are rebuilt by resolve(), the raster only needs the positions
+	model.bin(shader, vp, w, h, false).raster(id_buf, id, zbuf, aa);
+}
+
+void VisibilityBuffer::resolve(ColorBuffer &color_buf) {
+	assert(color_buf.width() == w && color_buf.height() == h);
+	assert(color_buf.simple_num() == aa);
+	color_buf.flush();	// rows share blocks
+	bool cloneable = true;
+	for (const Draw& d: draws)
+		cloneable = cloneable && d.copy;
+	if (!cloneable) {	// some shader can't be copied, resolve on this thread
+		std::vector<IShader*> shaders;
+		for (const Draw& d: draws)
+			shaders.push_back(d.shader);
+		for (int y = 0; y < h; ++y)
+			resolve_row(y, shaders, color_buf);
+		return;
+	}
+
+	#pragma omp parallel
+	{
+		// every thread loads the varyings into its own copies
+		std::vector<std::unique_ptr<IShader>> locals;
+		std::vector<IShader*> shaders;
+		for (const Draw& d: draws) {
+			locals.push_back(d.shader->clone());
+			shaders.push_back(locals.back().get());
+		}
+		#pragma omp for schedule(dynamic, 4)
+		for (int y = 0; y < h; ++y)
+			resolve_row(y, shaders, color_buf);
+	}
+}
+
+void VisibilityBuffer::resolve_row(int y, std::vector<IShader*> &shaders, ColorBuffer &color_buf) {
+	const vector<vec2>& offsets = sample_offsets(aa);
+	int n = offsets.size();
+	VisId cached;		// face whose varyings are loaded in its draw's shader
+	vec4  clip_coord[3];
+	for (int x = 0; x < w; ++x) {
+		VisId ids[16];
+		for (int i = 0; i < n; ++i)
+			ids[i] = id_buf.get(x, y, i);
+		uint32_t done = 0;
+		for (int i = 0; i < n; ++i) {
+			if (done >> i & 1 || ids[i].draw < 0)
+				continue;
+			// gather the samples covered by the same face and shade at their centroid
+			uint32_t group = 0;
+			int cnt = 0;
+			vec2 centroid(0, 0);
+			for (int j = i; j < n; ++j) {
+				if (ids[j] != ids[i])
+					continue;
+				group |= 1u << j;
+				++cnt;
+				centroid = centroid + offsets[j];
+			}
+			done |= group;
+			centroid = centroid / cnt;
+
+			const Draw& d = draws[ids[i].draw];
+			IShader* shader = shaders[ids[i].draw];
+			if (ids[i] != cached) {
+				for (int j = 0; j < 3; ++j)
+					clip_coord[j] = shader->vertex(ids[i].face, j);
+				cached = ids[i];
+			}
+			vec2 p = vec2(x, y) + centroid;
+			vec3 bar = Triangle::barycentric(clip_coord, d.vp, p);
+			shader->bar_ddx = Triangle::barycentric(clip_coord, d.vp, p + vec2(1, 0)) - bar;
+			shader->bar_ddy = Triangle::barycentric(clip_coord, d.vp, p + vec2(0, 1)) - bar;
+			std::optional<color_t> c(shader->fragment(bar));
+			if (!c.has_value() || c.value()[3] == 0)	// if alpha == 0, ignore it
+				continue;
+			for (int j = i; j < n; ++j)
+				if (group >> j & 1)
+					color_buf.set(x, y, j, c.value());
+		}
+	}
+}
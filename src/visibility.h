@@ -0,0 +1,44 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "gl.h"
+#include "buffer.h"
+#include "triangle.h"
+#include "model.h"
+
+/**
+ * deferred shading through a visibility buffer:
+ * 	draw()    : rasterize the faces of a model, only the id of the nearest
+ * 				face and its depth are kept per sample
+ * 	resolve() : run the fragment shader once for every group of samples of
+ * 				a pixel covered by the same face, and write its color to them
+ * so the shading cost depends on the screen size, not on the overdraw.
+ * only for opaque draws, blended ones go through Model::draw after resolve()
+ * with depth() as their depth buffer.
+ */
+class VisibilityBuffer {
+public:
+	VisibilityBuffer(int width, int height, Triangle::AA_Format aa_f = Triangle::NOAA);
+	// the shader is copied with clone() as it is now, if it can't be copied
+	// it must stay unchanged until resolve()
+	void draw(Model& model, IShader& shader, const mat4& vp);
+	void resolve(ColorBuffer& color_buf);
+	// forget the draws and clear the buffers for the next frame
+	void clear();
+	DepthBuffer& depth() { return zbuf; }
+	IdBuffer&    ids()   { return id_buf; }
+private:
+	struct Draw {
+		IShader* shader;
+		std::unique_ptr<IShader> copy;	// owns shader if it could be cloned
+		mat4     vp;
+	};
+	void resolve_row(int y, std::vector<IShader*>& shaders, ColorBuffer& color_buf);
+
+	int w;
+	int h;
+	Triangle::AA_Format aa;
+	DepthBuffer zbuf;
+	IdBuffer    id_buf;
+	std::vector<Draw> draws{};
+};
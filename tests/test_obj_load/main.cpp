@@ -0,0 +1,49 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include "model.h"
+
+// a quad whose faces leave out the kind of attribute the file lists anyway
+const char* VT_NO_REF =
+	"v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n"
+	"vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\n"
+	"vn 0 0 1\n"
+	"f 1//1 2//1 3//1\nf 1//1 3//1 4//1\n";
+const char* VN_NO_REF =
+	"v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n"
+	"vn 0 0 1\n"
+	"f 1 2 3\nf 1 3 4\n";
+
+bool check(const char* name, const char* obj) {
+	std::ofstream(name) << obj;
+	bool ok = true;
+	// twice, the second load comes from the mesh cache
+	for (int pass = 0; pass < 2; ++pass) {
+		Model model(name);
+		if (model.nfaces() != 2) {
+			std::cerr << name << ": " << model.nfaces() << " faces" << std::endl;
+			ok = false;
+			continue;
+		}
+		for (int i = 0; i < model.nfaces(); ++i) {
+			for (int j = 0; j < 3; ++j) {
+				vec3 n = model.normal(i, j);
+				if (std::abs(n.z - 1) > 1e-6) {
+					std::cerr << name << ": face " << i << " corner " << j << " normal " << n << std::endl;
+					ok = false;
+				}
+			}
+		}
+	}
+	std::remove(name);
+	std::remove((std::string(name) + ".mcache").c_str());
+	return ok;
+}
+
+int main() {
+	bool ok = check("vt_no_ref.obj", VT_NO_REF);
+	ok = check("vn_no_ref.obj", VN_NO_REF) && ok;
+	std::cout << (ok ? "passed" : "failed") << std::endl;
+	return ok ? 0 : 1;
+}